@@ -809,6 +809,34 @@ int sync(Object *to, Method meth, int arg) {
     return result;
 }
 
+int LOCK(Object *to) {
+    int result = -1;
+    char status;
+    DISABLE(status);
+    if (to->ownedBy == current)
+        result = 0;
+    else if (!to->ownedBy && status && to->wantedBy != INSTALLED_TAG) {
+        to->ownedBy = current;
+        result = 1;
+    }
+    ENABLE(status);
+    return result;
+}
+
+void UNLOCK(Object *to) {
+    Thread t;
+    char status;
+    DISABLE(status);
+    to->ownedBy = NULL;
+    t = to->wantedBy;
+    if (t && (t != INSTALLED_TAG)) {      // someone blocked on us meanwhile
+        to->wantedBy = NULL;
+        t->waitsFor = NULL;
+        dispatch(t);
+    }
+    ENABLE(status);
+}
+
 void ABORT(Msg m) {
     char status;
     DISABLE(status);
@@ -845,6 +873,15 @@ Time CURRENT_OFFSET(void) {
     return now - (status ? current->msg->baseline : timestamp);
 }
 
+Time CURRENT_DEADLINE(void) {
+    char status;
+    Time rel;
+    DISABLE(status);
+    rel = (status && current->msg) ? current->msg->deadline - current->msg->baseline : INFINITY;
+    ENABLE(status);
+    return rel;
+}
+
     
 /* initialization */
 static void initialize(void) {
@@ -364,6 +364,18 @@ Time T_SAMPLE(Timer *t);
 //      Return current time measured from current baseline
 Time CURRENT_OFFSET(void);
 
+//      Return current deadline measured from current baseline
+Time CURRENT_DEADLINE(void);
+
+//      Take the lock of object to for the current thread without calling a method,
+//      for callers that run the method themselves. Returns 1 if the lock was taken,
+//      0 if the current thread holds it already, and -1 if it can't be taken without
+//      blocking, in which case SYNC is the way to go
+int LOCK(Object *to);
+
+//      Release a lock taken by LOCK
+void UNLOCK(Object *to);
+
 
 // -------------------------------------------------------------------
 // No externally significant information below this line
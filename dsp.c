@@ -0,0 +1,118 @@
+#include "dsp.h"
+#include "vm.h"
+
+// Clamps to the int range
+static int saturate(long l)
+{
+    if(l > 32767)
+        return 32767;
+    if(l < -32768)
+        return -32768;
+    return (int) l;
+}
+
+// Sum of the array, 0 if it's not in VM memory
+static long sum(DspArrayArgs* args)
+{
+    long sum = 0;
+    if(args->n > 0 && inVmMemory(args->a, args->n*2))
+        for(int i = 0; i < args->n; i++)
+            sum += args->a[i];
+    return sum;
+}
+
+long vmMacQ15(Object* self, void* args)
+{
+    // long macQ15(int* a, int* b, int n), returns the sum of products in Q30
+    DspMacArgs* m = args;
+    int* a = m->a;
+    int* b = m->b;
+    long acc = 0;
+    if(m->n > 0 && inVmMemory(a, m->n*2) && inVmMemory(b, m->n*2))
+        for(int i = 0; i < m->n; i++)
+            acc += (long) a[i]*b[i];
+    return acc;
+}
+
+long vmMacQ7(Object* self, void* args)
+{
+    // long macQ7(char* a, char* b, int n), returns the sum of products in Q14
+    DspMacArgs* m = args;
+    char* a = m->a;
+    char* b = m->b;
+    long acc = 0;
+    if(m->n > 0 && inVmMemory(a, m->n) && inVmMemory(b, m->n))
+        for(int i = 0; i < m->n; i++)
+            acc += a[i]*b[i];
+    return acc;
+}
+
+long vmFirQ15(Object* self, void* args)
+{
+    // int firQ15(int* ring, int size, int newest, int* coeffs, int taps)
+    // Convolves the Q15 coefficients with the ring buffer going backwards from the
+    // newest sample, so coeffs[0] weighs ring[newest]. Returns a saturated Q15
+    DspFirArgs* f = args;
+    int pos = f->newest;
+    long acc = 0;
+    if(f->size > 0 && f->taps > 0 && pos >= 0 && pos < f->size
+       && inVmMemory(f->ring, f->size*2) && inVmMemory(f->coeffs, f->taps*2))
+    {
+        for(int i = 0; i < f->taps; i++)
+        {
+            acc += (long) f->coeffs[i]*f->ring[pos];
+            if(--pos < 0)
+                pos = f->size - 1;
+        }
+    }
+    return saturate(acc >> 15);
+}
+
+long vmSum(Object* self, void* args)
+{
+    // long sum(int* a, int n)
+    return sum(args);
+}
+
+long vmMin(Object* self, void* args)
+{
+    // int min(int* a, int n), 32767 for an empty array
+    DspArrayArgs* a = args;
+    int min = 32767;
+    if(a->n > 0 && inVmMemory(a->a, a->n*2))
+        for(int i = 0; i < a->n; i++)
+            if(a->a[i] < min)
+                min = a->a[i];
+    return min;
+}
+
+long vmMax(Object* self, void* args)
+{
+    // int max(int* a, int n), -32768 for an empty array
+    DspArrayArgs* a = args;
+    int max = -32768;
+    if(a->n > 0 && inVmMemory(a->a, a->n*2))
+        for(int i = 0; i < a->n; i++)
+            if(a->a[i] > max)
+                max = a->a[i];
+    return max;
+}
+
+long vmMean(Object* self, void* args)
+{
+    // int mean(int* a, int n), truncated towards zero, 0 for an empty array
+    DspArrayArgs* a = args;
+    return a->n > 0 ? sum(a)/a->n : 0;
+}
+
+long vmScale(Object* self, void* args)
+{
+    // void scale(int* dst, int* src, int n, int gain, char shift)
+    // dst[i] = saturate((src[i]*gain) >> shift), dst may be src
+    DspScaleArgs* s = args;
+    char shift = s->shift & 31;
+    if(s->n > 0 && inVmMemory(s->dst, s->n*2) && inVmMemory(s->src, s->n*2))
+        for(int i = 0; i < s->n; i++)
+            s->dst[i] = saturate(((long) s->src[i]*s->gain) >> shift);
+    return 0;
+}
@@ -0,0 +1,50 @@
+#ifndef DSP_H_
+#define DSP_H_
+
+#include "vm.h"
+
+// Fixed point kernels working on whole arrays in VM memory. All arrays are of
+// 16 bit words except for the Q7 ones which are of bytes, and lengths are in
+// elements
+
+typedef struct
+{
+    void* a;
+    void* b;
+    int n;
+} DspMacArgs;
+
+typedef struct
+{
+    int* ring;
+    int size;
+    int newest;
+    int* coeffs;
+    int taps;
+} DspFirArgs;
+
+typedef struct
+{
+    int* a;
+    int n;
+} DspArrayArgs;
+
+typedef struct
+{
+    int* dst;
+    int* src;
+    int n;
+    int gain;
+    char shift;
+} DspScaleArgs;
+
+long vmMacQ15(Object* self, void* args);
+long vmMacQ7(Object* self, void* args);
+long vmFirQ15(Object* self, void* args);
+long vmSum(Object* self, void* args);
+long vmMin(Object* self, void* args);
+long vmMax(Object* self, void* args);
+long vmMean(Object* self, void* args);
+long vmScale(Object* self, void* args);
+
+#endif
@@ -27,7 +27,8 @@ int turnOff(Led* self, int dummy)
 
 int toggle(Led* self, int dummy)
 {
-    PORTB ^= (1 << 7);
+    // Writing a one to PINB toggles the pin, in one write that nothing can come between
+    PINB = (1 << 7);
     return 1;
 }
 
@@ -36,20 +37,19 @@ bool isOn(Led* self, int dummy)
     return (PORTB | (1 << 7)) != 0;
 }
 
-void vmToggleLed(VmThread* thread)
+long vmToggleLed(Object* self, void* args)
 {
-    // No arguments to this function, so we don't need to care about the thread sent
-    SYNC(&led, toggle, 0);
-    thread->sp = thread->fp + 4;
+    toggle((Led*) self, 0);
+    return 0;
 }
 
-void vmSetLed(VmThread* thread)
+long vmSetLed(Object* self, void* args)
 {
-    if(getChar(thread->fp + 4) == 0)
-        SYNC(&led, turnOn, 0);
+    if(getChar(args) == 0)
+        turnOn((Led*) self, 0);
     else
-        SYNC(&led, turnOff, 0);
-    thread->sp = thread->fp + 5;
+        turnOff((Led*) self, 0);
+    return 0;
 }
 
 #endif
\ No newline at end of file
@@ -18,8 +18,8 @@ int turnOff(Led* self, int dummy);
 int toggle(Led* self, int dummy);
 bool isOn(Led* self, int dummy);
 
-void vmToggleLed(VmThread* thread);
-void vmSetLed(VmThread* thread);
+long vmToggleLed(Object* self, void* args);
+long vmSetLed(Object* self, void* args);
 
 extern Led led;
 
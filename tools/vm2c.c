@@ -0,0 +1,572 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../vmops.h"
+
+// Translates a linked program image, header included, into C with a function per VM
+// method, to be built with vmrt.c into a host program that runs it in simulated time
+// (see vmrt.c). The translation works on VM memory exactly like executeInstruction()
+// does, it only leaves out the dispatch: jumps become gotos, calls become C calls with
+// the frame still pushed to VM memory, and RET returns.
+//
+// Methods are the entry point, the targets of CALL and TAILCALL and the addresses of
+// instructions pushed by PUSHADDR (what SYNC and ASYNC get called with). A method runs
+// until the next one starts. Its function returns 0 on RET, or the address of the method
+// to go on with in the same frame when it tail calls, jumps to or runs into another one,
+// and call() loops over those so that the C stack only grows with VM calls. SLEEP, AWAIT and
+// NOTIFY need threads that can be suspended, which the translation doesn't have, the
+// superinstructions are only made on the device and OP_NATIVE is reserved, so an image
+// with any of them is rejected
+
+#define VM_MEMORY_SIZE 3500 // as in vm.h
+#define VM_IOSIZE 0x200     // as in vmrt.h
+
+// How the operands following the opcode are read into the values printed by the
+// translation of the instruction
+enum
+{
+    K_NONE,
+    K_B,   // signed byte
+    K_UB,  // unsigned byte
+    K_W,   // word
+    K_L,   // dword
+    K_WB,  // word, unsigned byte
+    K_WC,  // word, signed byte
+    K_WW,  // word, word
+    K_WL,  // word, dword
+    K_IO,  // I/O register address, unsigned byte mask
+    K_J,   // jump target
+    K_S,   // short jump, the target is relative to the next instruction
+    K_WJ,  // word, jump target
+    K_PC,  // no operands, the address of the instruction is printed
+    K_SPECIAL // translated in emitInstruction()
+};
+
+typedef struct
+{
+    unsigned char length; // 0 for opcodes we can't translate
+    unsigned char kind;
+    const char* code;     // printf format for the values of the operands
+} OpInfo;
+
+static const OpInfo ops[256] =
+{
+    [OP_PUSHFP] = { 3, K_W, "pushInt(fp + %ld);" },
+    [OP_PUSHIMM] = { 3, K_W, "sp -= %ld;" },
+    [OP_PUSHADDR] = { 3, K_W, "pushInt(%ld);" },
+    [OP_PUSHBYTEFP] = { 3, K_W, "pushChar(getChar(fp + %ld));" },
+    [OP_PUSHWORDFP] = { 3, K_W, "pushInt(getInt(fp + %ld));" },
+    [OP_PUSHDWORDFP] = { 3, K_W, "pushLong(getLong(fp + %ld));" },
+    [OP_PUSHBYTEADDR] = { 3, K_W, "pushChar(getChar(%ld));" },
+    [OP_PUSHWORDADDR] = { 3, K_W, "pushInt(getInt(%ld));" },
+    [OP_PUSHDWORDADDR] = { 3, K_W, "pushLong(getLong(%ld));" },
+    [OP_PUSHBYTEIMM] = { 2, K_B, "pushChar(%ld);" },
+    [OP_PUSHWORDIMM] = { 3, K_W, "pushInt(%ld);" },
+    [OP_PUSHDWORDIMM] = { 5, K_L, "pushLong(%ldL);" },
+    [OP_PUSHBYTE] = { 1, K_NONE, "pushChar(getChar(popInt()));" },
+    [OP_PUSHWORD] = { 1, K_NONE, "pushInt(getInt(popInt()));" },
+    [OP_PUSHDWORD] = { 1, K_NONE, "pushLong(getLong(popInt()));" },
+    [OP_POPIMM] = { 3, K_W, "sp += %ld;" },
+    [OP_POPBYTEFP] = { 3, K_W, "setChar(fp + %ld, popChar());" },
+    [OP_POPWORDFP] = { 3, K_W, "setInt(fp + %ld, popInt());" },
+    [OP_POPDWORDFP] = { 3, K_W, "setLong(fp + %ld, popLong());" },
+    [OP_POPBYTEADDR] = { 3, K_W, "setChar(%ld, popChar());" },
+    [OP_POPWORDADDR] = { 3, K_W, "setInt(%ld, popInt());" },
+    [OP_POPDWORDADDR] = { 3, K_W, "setLong(%ld, popLong());" },
+    [OP_POPBYTE] = { 1, K_NONE, "{ uint16_t a = popInt(); setChar(a, popChar()); }" },
+    [OP_POPWORD] = { 1, K_NONE, "{ uint16_t a = popInt(); setInt(a, popInt()); }" },
+    [OP_POPDWORD] = { 1, K_NONE, "{ uint16_t a = popInt(); setLong(a, popLong()); }" },
+    [OP_CALL] = { 3, K_SPECIAL },
+    [OP_RET] = { 3, K_W, "sp = fp + %ld + 4; fp = getInt(fp); return 0;" },
+    [OP_SYNC] = { 1, K_SPECIAL },
+    [OP_ASYNC] = { 1, K_NONE, "vmAsync();" },
+    [OP_CALLE] = { 3, K_SPECIAL },
+    [OP_ADDBYTE] = { 1, K_NONE, "BINARY(int8_t, popChar, pushChar, +);" },
+    [OP_ADDWORD] = { 1, K_NONE, "BINARY(int16_t, popInt, pushInt, +);" },
+    [OP_ADDDWORD] = { 1, K_NONE, "BINARY(uint32_t, popLong, pushLong, +);" },
+    [OP_SUBBYTE] = { 1, K_NONE, "BINARY(int8_t, popChar, pushChar, -);" },
+    [OP_SUBWORD] = { 1, K_NONE, "BINARY(int16_t, popInt, pushInt, -);" },
+    [OP_SUBDWORD] = { 1, K_NONE, "BINARY(uint32_t, popLong, pushLong, -);" },
+    [OP_MULBYTE] = { 1, K_NONE, "BINARY(int8_t, popChar, pushChar, *);" },
+    [OP_MULWORD] = { 1, K_NONE, "BINARY(int16_t, popInt, pushInt, *);" },
+    [OP_MULDWORD] = { 1, K_NONE, "BINARY(uint32_t, popLong, pushLong, *);" },
+    [OP_DIVBYTE] = { 1, K_PC, "DIVIDE(popChar, pushChar, /, %ld);" },
+    [OP_DIVWORD] = { 1, K_PC, "DIVIDE(popInt, pushInt, /, %ld);" },
+    [OP_DIVDWORD] = { 1, K_PC, "DIVIDE(popLong, pushLong, /, %ld);" },
+    [OP_MODBYTE] = { 1, K_PC, "DIVIDE(popChar, pushChar, %%, %ld);" },
+    [OP_MODWORD] = { 1, K_PC, "DIVIDE(popInt, pushInt, %%, %ld);" },
+    [OP_MODDWORD] = { 1, K_PC, "DIVIDE(popLong, pushLong, %%, %ld);" },
+    [OP_ANDBYTE] = { 1, K_NONE, "BINARY(int8_t, popChar, pushChar, &);" },
+    [OP_ANDWORD] = { 1, K_NONE, "BINARY(int16_t, popInt, pushInt, &);" },
+    [OP_ANDDWORD] = { 1, K_NONE, "BINARY(int32_t, popLong, pushLong, &);" },
+    [OP_ORBYTE] = { 1, K_NONE, "BINARY(int8_t, popChar, pushChar, |);" },
+    [OP_ORWORD] = { 1, K_NONE, "BINARY(int16_t, popInt, pushInt, |);" },
+    [OP_ORDWORD] = { 1, K_NONE, "BINARY(int32_t, popLong, pushLong, |);" },
+    [OP_XORBYTE] = { 1, K_NONE, "BINARY(int8_t, popChar, pushChar, ^);" },
+    [OP_XORWORD] = { 1, K_NONE, "BINARY(int16_t, popInt, pushInt, ^);" },
+    [OP_XORDWORD] = { 1, K_NONE, "BINARY(int32_t, popLong, pushLong, ^);" },
+    [OP_SGZBYTE] = { 1, K_NONE, "pushChar(popChar() > 0);" },
+    [OP_SGZWORD] = { 1, K_NONE, "pushChar(popInt() > 0);" },
+    [OP_SGZDWORD] = { 1, K_NONE, "pushChar(popLong() > 0);" },
+    [OP_SGEZBYTE] = { 1, K_NONE, "pushChar(popChar() >= 0);" },
+    [OP_SGEZWORD] = { 1, K_NONE, "pushChar(popInt() >= 0);" },
+    [OP_SGEZDWORD] = { 1, K_NONE, "pushChar(popLong() >= 0);" },
+    [OP_SEZBYTE] = { 1, K_NONE, "pushChar(popChar() == 0);" },
+    [OP_SEZWORD] = { 1, K_NONE, "pushChar(popInt() == 0);" },
+    [OP_SEZDWORD] = { 1, K_NONE, "pushChar(popLong() == 0);" },
+    [OP_SNEZBYTE] = { 1, K_NONE, "pushChar(popChar() != 0);" },
+    [OP_SNEZWORD] = { 1, K_NONE, "pushChar(popInt() != 0);" },
+    [OP_SNEZDWORD] = { 1, K_NONE, "pushChar(popLong() != 0);" },
+    [OP_JMP] = { 3, K_J, "goto L_%04lx;" },
+    [OP_JEZ] = { 3, K_J, "if(popChar() == 0) goto L_%04lx;" },
+    [OP_JNEZ] = { 3, K_J, "if(popChar() != 0) goto L_%04lx;" },
+    [OP_SLLBYTE] = { 2, K_B, "pushChar(vmShl(popChar(), %ld));" },
+    [OP_SLLWORD] = { 2, K_B, "pushInt(vmShl(popInt(), %ld));" },
+    [OP_SLLDWORD] = { 2, K_B, "pushLong(vmShl(popLong(), %ld));" },
+    [OP_SLLVBYTE] = { 1, K_NONE, "{ int8_t a = popChar(); pushChar(vmShl(a, popChar())); }" },
+    [OP_SLLVWORD] = { 1, K_NONE, "{ int16_t a = popInt(); pushInt(vmShl(a, popChar())); }" },
+    [OP_SLLVDWORD] = { 1, K_NONE, "{ int32_t a = popLong(); pushLong(vmShl(a, popChar())); }" },
+    [OP_SRLBYTE] = { 2, K_B, "pushChar(vmShr((uint8_t) popChar(), %ld));" },
+    [OP_SRLWORD] = { 2, K_B, "pushInt(vmShr((uint16_t) popInt(), %ld));" },
+    [OP_SRLDWORD] = { 2, K_B, "pushLong(vmShr((uint32_t) popLong(), %ld));" },
+    [OP_SRLVBYTE] = { 1, K_NONE, "{ uint8_t a = popChar(); pushChar(vmShr(a, popChar())); }" },
+    [OP_SRLVWORD] = { 1, K_NONE, "{ uint16_t a = popInt(); pushInt(vmShr(a, popChar())); }" },
+    [OP_SRLVDWORD] = { 1, K_NONE, "{ uint32_t a = popLong(); pushLong(vmShr(a, popChar())); }" },
+    [OP_SRABYTE] = { 2, K_B, "pushChar(vmSar(popChar(), %ld));" },
+    [OP_SRAWORD] = { 2, K_B, "pushInt(vmSar(popInt(), %ld));" },
+    [OP_SRADWORD] = { 2, K_B, "pushLong(vmSar(popLong(), %ld));" },
+    [OP_SRAVBYTE] = { 1, K_NONE, "{ int8_t a = popChar(); pushChar(vmSar(a, popChar())); }" },
+    [OP_SRAVWORD] = { 1, K_NONE, "{ int16_t a = popInt(); pushInt(vmSar(a, popChar())); }" },
+    [OP_SRAVDWORD] = { 1, K_NONE, "{ int32_t a = popLong(); pushLong(vmSar(a, popChar())); }" },
+    [OP_SLTBYTE] = { 1, K_NONE, "COMPARE(int8_t, popChar, <);" },
+    [OP_SLTWORD] = { 1, K_NONE, "COMPARE(int16_t, popInt, <);" },
+    [OP_SLTDWORD] = { 1, K_NONE, "COMPARE(int32_t, popLong, <);" },
+    [OP_SLEBYTE] = { 1, K_NONE, "COMPARE(int8_t, popChar, <=);" },
+    [OP_SLEWORD] = { 1, K_NONE, "COMPARE(int16_t, popInt, <=);" },
+    [OP_SLEDWORD] = { 1, K_NONE, "COMPARE(int32_t, popLong, <=);" },
+    [OP_SEQBYTE] = { 1, K_NONE, "COMPARE(int8_t, popChar, ==);" },
+    [OP_SEQWORD] = { 1, K_NONE, "COMPARE(int16_t, popInt, ==);" },
+    [OP_SEQDWORD] = { 1, K_NONE, "COMPARE(int32_t, popLong, ==);" },
+    [OP_SNEBYTE] = { 1, K_NONE, "COMPARE(int8_t, popChar, !=);" },
+    [OP_SNEWORD] = { 1, K_NONE, "COMPARE(int16_t, popInt, !=);" },
+    [OP_SNEDWORD] = { 1, K_NONE, "COMPARE(int32_t, popLong, !=);" },
+    [OP_SLTUBYTE] = { 1, K_NONE, "COMPARE(uint8_t, popChar, <);" },
+    [OP_SLTUWORD] = { 1, K_NONE, "COMPARE(uint16_t, popInt, <);" },
+    [OP_SLTUDWORD] = { 1, K_NONE, "COMPARE(uint32_t, popLong, <);" },
+    [OP_SLEUBYTE] = { 1, K_NONE, "COMPARE(uint8_t, popChar, <=);" },
+    [OP_SLEUWORD] = { 1, K_NONE, "COMPARE(uint16_t, popInt, <=);" },
+    [OP_SLEUDWORD] = { 1, K_NONE, "COMPARE(uint32_t, popLong, <=);" },
+    [OP_JLTBYTE] = { 3, K_J, "if(COND(int8_t, popChar, <)) goto L_%04lx;" },
+    [OP_JLTWORD] = { 3, K_J, "if(COND(int16_t, popInt, <)) goto L_%04lx;" },
+    [OP_JLTDWORD] = { 3, K_J, "if(COND(int32_t, popLong, <)) goto L_%04lx;" },
+    [OP_JGEBYTE] = { 3, K_J, "if(COND(int8_t, popChar, >=)) goto L_%04lx;" },
+    [OP_JGEWORD] = { 3, K_J, "if(COND(int16_t, popInt, >=)) goto L_%04lx;" },
+    [OP_JGEDWORD] = { 3, K_J, "if(COND(int32_t, popLong, >=)) goto L_%04lx;" },
+    [OP_JEQBYTE] = { 3, K_J, "if(COND(int8_t, popChar, ==)) goto L_%04lx;" },
+    [OP_JEQWORD] = { 3, K_J, "if(COND(int16_t, popInt, ==)) goto L_%04lx;" },
+    [OP_JEQDWORD] = { 3, K_J, "if(COND(int32_t, popLong, ==)) goto L_%04lx;" },
+    [OP_JNEBYTE] = { 3, K_J, "if(COND(int8_t, popChar, !=)) goto L_%04lx;" },
+    [OP_JNEWORD] = { 3, K_J, "if(COND(int16_t, popInt, !=)) goto L_%04lx;" },
+    [OP_JNEDWORD] = { 3, K_J, "if(COND(int32_t, popLong, !=)) goto L_%04lx;" },
+    [OP_JLTUBYTE] = { 3, K_J, "if(COND(uint8_t, popChar, <)) goto L_%04lx;" },
+    [OP_JLTUWORD] = { 3, K_J, "if(COND(uint16_t, popInt, <)) goto L_%04lx;" },
+    [OP_JLTUDWORD] = { 3, K_J, "if(COND(uint32_t, popLong, <)) goto L_%04lx;" },
+    [OP_JGEUBYTE] = { 3, K_J, "if(COND(uint8_t, popChar, >=)) goto L_%04lx;" },
+    [OP_JGEUWORD] = { 3, K_J, "if(COND(uint16_t, popInt, >=)) goto L_%04lx;" },
+    [OP_JGEUDWORD] = { 3, K_J, "if(COND(uint32_t, popLong, >=)) goto L_%04lx;" },
+    [OP_ADDBYTEIMM] = { 2, K_B, "setChar(sp, getChar(sp) + %ld);" },
+    [OP_ADDWORDIMM] = { 3, K_W, "setInt(sp, getInt(sp) + %ld);" },
+    [OP_ADDDWORDIMM] = { 5, K_L, "setLong(sp, (uint32_t) getLong(sp) + (uint32_t) %ldL);" },
+    [OP_SUBBYTEIMM] = { 2, K_B, "setChar(sp, getChar(sp) - %ld);" },
+    [OP_SUBWORDIMM] = { 3, K_W, "setInt(sp, getInt(sp) - %ld);" },
+    [OP_SUBDWORDIMM] = { 5, K_L, "setLong(sp, (uint32_t) getLong(sp) - (uint32_t) %ldL);" },
+    [OP_ANDBYTEIMM] = { 2, K_B, "setChar(sp, getChar(sp) & %ld);" },
+    [OP_ANDWORDIMM] = { 3, K_W, "setInt(sp, getInt(sp) & %ld);" },
+    [OP_ANDDWORDIMM] = { 5, K_L, "setLong(sp, getLong(sp) & %ldL);" },
+    [OP_ORBYTEIMM] = { 2, K_B, "setChar(sp, getChar(sp) | %ld);" },
+    [OP_ORWORDIMM] = { 3, K_W, "setInt(sp, getInt(sp) | %ld);" },
+    [OP_ORDWORDIMM] = { 5, K_L, "setLong(sp, getLong(sp) | %ldL);" },
+    [OP_XORBYTEIMM] = { 2, K_B, "setChar(sp, getChar(sp) ^ %ld);" },
+    [OP_XORWORDIMM] = { 3, K_W, "setInt(sp, getInt(sp) ^ %ld);" },
+    [OP_XORDWORDIMM] = { 5, K_L, "setLong(sp, getLong(sp) ^ %ldL);" },
+    [OP_MULBYTEIMM] = { 2, K_B, "setChar(sp, getChar(sp) * %ld);" },
+    [OP_MULWORDIMM] = { 3, K_W, "setInt(sp, getInt(sp) * %ld);" },
+    [OP_MULDWORDIMM] = { 5, K_L, "setLong(sp, (uint32_t) getLong(sp) * (uint32_t) %ldL);" },
+    [OP_INCBYTEFP] = { 4, K_WC, "{ uint16_t a = fp + %ld; setChar(a, getChar(a) + %ld); }" },
+    [OP_INCWORDFP] = { 5, K_WW, "{ uint16_t a = fp + %ld; setInt(a, getInt(a) + %ld); }" },
+    [OP_INCDWORDFP] = { 7, K_WL, "{ uint16_t a = fp + %ld; setLong(a, (uint32_t) getLong(a) + (uint32_t) %ldL); }" },
+    [OP_PUSHBYTEADDRIDX] = { 4, K_WB, "pushChar(getChar(%ld + popInt()*%ld));" },
+    [OP_PUSHWORDADDRIDX] = { 4, K_WB, "pushInt(getInt(%ld + popInt()*%ld));" },
+    [OP_PUSHDWORDADDRIDX] = { 4, K_WB, "pushLong(getLong(%ld + popInt()*%ld));" },
+    [OP_PUSHBYTEFPIDX] = { 4, K_WB, "pushChar(getChar(fp + %ld + popInt()*%ld));" },
+    [OP_PUSHWORDFPIDX] = { 4, K_WB, "pushInt(getInt(fp + %ld + popInt()*%ld));" },
+    [OP_PUSHDWORDFPIDX] = { 4, K_WB, "pushLong(getLong(fp + %ld + popInt()*%ld));" },
+    [OP_PUSHBYTEDISP] = { 3, K_W, "pushChar(getChar(popInt() + %ld));" },
+    [OP_PUSHWORDDISP] = { 3, K_W, "pushInt(getInt(popInt() + %ld));" },
+    [OP_PUSHDWORDDISP] = { 3, K_W, "pushLong(getLong(popInt() + %ld));" },
+    [OP_POPBYTEADDRIDX] = { 4, K_WB, "{ uint16_t a = %ld + popInt()*%ld; setChar(a, popChar()); }" },
+    [OP_POPWORDADDRIDX] = { 4, K_WB, "{ uint16_t a = %ld + popInt()*%ld; setInt(a, popInt()); }" },
+    [OP_POPDWORDADDRIDX] = { 4, K_WB, "{ uint16_t a = %ld + popInt()*%ld; setLong(a, popLong()); }" },
+    [OP_POPBYTEFPIDX] = { 4, K_WB, "{ uint16_t a = fp + %ld + popInt()*%ld; setChar(a, popChar()); }" },
+    [OP_POPWORDFPIDX] = { 4, K_WB, "{ uint16_t a = fp + %ld + popInt()*%ld; setInt(a, popInt()); }" },
+    [OP_POPDWORDFPIDX] = { 4, K_WB, "{ uint16_t a = fp + %ld + popInt()*%ld; setLong(a, popLong()); }" },
+    [OP_POPBYTEDISP] = { 3, K_W, "{ uint16_t a = popInt() + %ld; setChar(a, popChar()); }" },
+    [OP_POPWORDDISP] = { 3, K_W, "{ uint16_t a = popInt() + %ld; setInt(a, popInt()); }" },
+    [OP_POPDWORDDISP] = { 3, K_W, "{ uint16_t a = popInt() + %ld; setLong(a, popLong()); }" },
+    [OP_PUSHFPS] = { 2, K_B, "pushInt(fp + %ld);" },
+    [OP_PUSHBYTEFPS] = { 2, K_B, "pushChar(getChar(fp + %ld));" },
+    [OP_PUSHWORDFPS] = { 2, K_B, "pushInt(getInt(fp + %ld));" },
+    [OP_PUSHDWORDFPS] = { 2, K_B, "pushLong(getLong(fp + %ld));" },
+    [OP_POPBYTEFPS] = { 2, K_B, "setChar(fp + %ld, popChar());" },
+    [OP_POPWORDFPS] = { 2, K_B, "setInt(fp + %ld, popInt());" },
+    [OP_POPDWORDFPS] = { 2, K_B, "setLong(fp + %ld, popLong());" },
+    [OP_PUSHWORDIMMS] = { 2, K_B, "pushInt(%ld);" },
+    [OP_PUSHDWORDIMMS] = { 2, K_B, "pushLong(%ld);" },
+    [OP_PUSHIMMS] = { 2, K_UB, "sp -= %ld;" },
+    [OP_POPIMMS] = { 2, K_UB, "sp += %ld;" },
+    [OP_PUSHWORDLOC0] = { 1, K_NONE, "pushInt(getInt(fp - 2));" },
+    [OP_PUSHWORDLOC1] = { 1, K_NONE, "pushInt(getInt(fp - 4));" },
+    [OP_PUSHWORDLOC2] = { 1, K_NONE, "pushInt(getInt(fp - 6));" },
+    [OP_PUSHWORDLOC3] = { 1, K_NONE, "pushInt(getInt(fp - 8));" },
+    [OP_POPWORDLOC0] = { 1, K_NONE, "setInt(fp - 2, popInt());" },
+    [OP_POPWORDLOC1] = { 1, K_NONE, "setInt(fp - 4, popInt());" },
+    [OP_POPWORDLOC2] = { 1, K_NONE, "setInt(fp - 6, popInt());" },
+    [OP_POPWORDLOC3] = { 1, K_NONE, "setInt(fp - 8, popInt());" },
+    [OP_PUSHWORDARG0] = { 1, K_NONE, "pushInt(getInt(fp + 4));" },
+    [OP_PUSHWORDARG1] = { 1, K_NONE, "pushInt(getInt(fp + 6));" },
+    [OP_JMPS] = { 2, K_S, "goto L_%04lx;" },
+    [OP_JEZS] = { 2, K_S, "if(popChar() == 0) goto L_%04lx;" },
+    [OP_JNEZS] = { 2, K_S, "if(popChar() != 0) goto L_%04lx;" },
+    [OP_TABLESWITCH] = { 4, K_SPECIAL },
+    [OP_IN] = { 4, K_IO, "pushChar(vmIo[%ld] & %ld);" },
+    [OP_OUT] = { 4, K_IO, "vmOut(%ld, %ld, popChar());" },
+    [OP_SBI] = { 4, K_IO, "vmOut(%ld, %ld, -1);" },
+    [OP_CBI] = { 4, K_IO, "vmOut(%ld, %ld, 0);" },
+    [OP_DJNZWORDFP] = { 5, K_WJ, "{ uint16_t a = fp + %ld; setInt(a, getInt(a) - 1); if(getInt(a) != 0) goto L_%04lx; }" },
+    [OP_TAILCALL] = { 5, K_SPECIAL },
+    [OP_HOT] = { 2, K_NONE, "" }
+};
+
+// In the order of the extern IDs in vm.h
+static const char* externNames[] =
+{
+    "memcpy", "memset", "memcmp", "memchr", "macQ15", "macQ7", "firQ15", "sum", "min",
+    "max", "mean", "scale", "toggleLed", "setLed", "setUartCallback", "uartTransmit",
+    "poolCreate", "poolAlloc", "poolFree", "poolUsage"
+};
+
+static unsigned char mem[VM_MEMORY_SIZE];
+static unsigned int size;
+static unsigned int entryObject, programSection, entryPoint, externSection;
+
+static bool isInstruction[VM_MEMORY_SIZE];
+static bool isMethod[VM_MEMORY_SIZE];
+static bool isTarget[VM_MEMORY_SIZE];
+static bool isOutside[VM_MEMORY_SIZE]; // Targets outside the method being emitted
+
+static void error(unsigned int pos, const char* what)
+{
+    fprintf(stderr, "vm2c: %04x: %s\n", pos, what);
+    exit(1);
+}
+
+static int getChar(unsigned int pos) { return (signed char) mem[pos]; }
+static int getInt(unsigned int pos) { return (short) (mem[pos] | mem[pos + 1] << 8); }
+static unsigned int getAddr(unsigned int pos) { return mem[pos] | mem[pos + 1] << 8; }
+
+static long getLong(unsigned int pos)
+{
+    return (int) ((unsigned long) getAddr(pos) | (unsigned long) getAddr(pos + 2) << 16);
+}
+
+static int instructionSize(unsigned int pos)
+{
+    unsigned char opCode = mem[pos];
+    if(opCode == OP_TABLESWITCH)
+        return 4 + 2*mem[pos + 1];
+    return ops[opCode].length;
+}
+
+// Reads the operands of the instruction at pos, and returns its jump target if it has one
+static long decode(unsigned int pos, long* a, long* b)
+{
+    *a = *b = 0;
+    switch(ops[mem[pos]].kind)
+    {
+    case K_B: *a = getChar(pos + 1); break;
+    case K_UB: *a = mem[pos + 1]; break;
+    case K_W: *a = getInt(pos + 1); break;
+    case K_L: *a = getLong(pos + 1); break;
+    case K_WB: *a = getInt(pos + 1); *b = mem[pos + 3]; break;
+    case K_WC: *a = getInt(pos + 1); *b = getChar(pos + 3); break;
+    case K_WW: *a = getInt(pos + 1); *b = getInt(pos + 3); break;
+    case K_WL: *a = getInt(pos + 1); *b = getLong(pos + 3); break;
+    case K_IO: *a = getAddr(pos + 1); *b = mem[pos + 3]; break;
+    case K_J: *a = getAddr(pos + 1); return *a;
+    case K_S: *a = pos + 2 + getChar(pos + 1); return *a;
+    case K_WJ: *a = getInt(pos + 1); *b = getAddr(pos + 3); return *b;
+    case K_PC: *a = pos; break;
+    }
+    return -1;
+}
+
+static void markTarget(unsigned int pos, long target)
+{
+    if(target < programSection || target >= externSection || !isInstruction[target])
+        error(pos, "jump to something that is not an instruction");
+    isTarget[target] = true;
+}
+
+static void markMethod(unsigned int pos, unsigned int target)
+{
+    if(target < programSection || target >= externSection || !isInstruction[target])
+        error(pos, "call of something that is not an instruction");
+    isMethod[target] = true;
+}
+
+// The ID of the extern an OP_CALL into the extern section calls by name
+static int externId(unsigned int pos, unsigned int name)
+{
+    unsigned int end = name;
+    while(end < size && mem[end])
+        end++;
+    if(end == size)
+        error(pos, "extern name without an end");
+    for(unsigned int i = 0; i < sizeof(externNames)/sizeof(*externNames); i++)
+        if(!strcmp((char*) mem + name, externNames[i]))
+            return i;
+    error(pos, "no extern with that name");
+    return -1;
+}
+
+// Finds the instructions, the methods and the jump targets, and rejects what we can't
+// translate
+static void scan()
+{
+    for(unsigned int pos = programSection; pos < externSection; pos += instructionSize(pos))
+    {
+        unsigned char opCode = mem[pos];
+        if(!ops[opCode].length)
+            error(pos, opCode == OP_SLEEP || opCode == OP_AWAIT || opCode == OP_NOTIFY
+                       || opCode == OP_CHSEND || opCode == OP_CHRECV
+                       ? "suspending threads is not supported"
+                       : opCode == OP_ASYNCF || opCode == OP_FPOLL || opCode == OP_FAWAIT
+                       ? "futures are not supported"
+                       : opCode >= OP_ADDWORDFPFP && opCode <= OP_MOVWORDIMMFP
+                       ? "opcode only made on the device" : "unknown opcode");
+        if(pos + instructionSize(pos) > externSection)
+            error(pos, "instruction runs into the extern section");
+        isInstruction[pos] = true;
+    }
+
+    isMethod[entryPoint] = true;
+    for(unsigned int pos = programSection; pos < externSection; pos += instructionSize(pos))
+    {
+        long a, b;
+        long target = decode(pos, &a, &b);
+        if(target >= 0)
+            markTarget(pos, target);
+        switch(mem[pos])
+        {
+        case OP_PUSHADDR:
+            // Anything else pushed is data
+            if(getAddr(pos + 1) >= programSection && getAddr(pos + 1) < externSection
+               && isInstruction[getAddr(pos + 1)])
+                isMethod[getAddr(pos + 1)] = true;
+            break;
+        case OP_CALL:
+            if(getAddr(pos + 1) < externSection)
+                markMethod(pos, getAddr(pos + 1));
+            else
+                externId(pos, getAddr(pos + 1));
+            break;
+        case OP_CALLE:
+            if(getAddr(pos + 1) >= sizeof(externNames)/sizeof(*externNames))
+                error(pos, "no extern with that ID");
+            break;
+        case OP_TAILCALL:
+            markMethod(pos, getAddr(pos + 1));
+            break;
+        case OP_TABLESWITCH:
+            for(unsigned int entry = pos + 2; entry < pos + instructionSize(pos); entry += 2)
+                markTarget(pos, getAddr(entry));
+            break;
+        case OP_IN:
+        case OP_OUT:
+        case OP_SBI:
+        case OP_CBI:
+            if(getAddr(pos + 1) >= VM_IOSIZE)
+                error(pos, "not an I/O register");
+            break;
+        }
+    }
+}
+
+// Jumps out of the method get a label at the end of it, see emitMethod()
+static void checkTarget(unsigned int method, unsigned int end, unsigned int target)
+{
+    if(target < method || target >= end)
+    {
+        if(!isMethod[target])
+            error(target, "jump into another method");
+        isOutside[target] = true;
+    }
+}
+
+static void emitInstruction(FILE* out, unsigned int method, unsigned int end, unsigned int pos)
+{
+    unsigned char opCode = mem[pos];
+    const OpInfo* op = &ops[opCode];
+    long a, b;
+    long target = decode(pos, &a, &b);
+    if(target >= 0)
+        checkTarget(method, end, target);
+
+    fprintf(out, "    ");
+    switch(opCode)
+    {
+    case OP_CALL:
+        if(getAddr(pos + 1) >= externSection)
+            fprintf(out, "vmCallExtern(%d);", externId(pos, getAddr(pos + 1)));
+        else
+            fprintf(out, "pushInt(%d); pushInt(fp); fp = sp; call(0x%04x);", pos + 3, getAddr(pos + 1));
+        break;
+    case OP_CALLE:
+        fprintf(out, "vmCallExtern(%d);", getAddr(pos + 1));
+        break;
+    case OP_SYNC:
+        // The stackless SYNC of vm.c, the object can't be busy here
+        fprintf(out, "{ uint16_t obj = popInt(); uint16_t method = popInt(); "
+                     "pushInt(%d); pushInt(fp); fp = sp; vmSync(obj, method); }", pos + 1);
+        break;
+    case OP_TAILCALL:
+        fprintf(out, "vmTailCall(%d, %d); ", mem[pos + 3], mem[pos + 4]);
+        // Loops written as tail calls to themselves stay loops
+        if(getAddr(pos + 1) == method)
+            fprintf(out, "goto L_%04x;", method);
+        else
+            fprintf(out, "return 0x%04x;", getAddr(pos + 1));
+        break;
+    case OP_TABLESWITCH:
+        fprintf(out, "switch((uint16_t) popInt())\n    {\n");
+        for(int i = 0; i < mem[pos + 1]; i++)
+        {
+            checkTarget(method, end, getAddr(pos + 4 + 2*i));
+            fprintf(out, "    case %d: goto L_%04x;\n", i, getAddr(pos + 4 + 2*i));
+        }
+        checkTarget(method, end, getAddr(pos + 2));
+        fprintf(out, "    default: goto L_%04x;\n    }", getAddr(pos + 2));
+        break;
+    default:
+        fprintf(out, op->code, a, b);
+        break;
+    }
+    fprintf(out, "\n");
+}
+
+static bool fallsThrough(unsigned char opCode)
+{
+    return opCode != OP_RET && opCode != OP_JMP && opCode != OP_JMPS
+           && opCode != OP_TAILCALL && opCode != OP_TABLESWITCH;
+}
+
+static void emitMethod(FILE* out, unsigned int method)
+{
+    unsigned int end = method + 1;
+    while(end < externSection && !isMethod[end])
+        end++;
+    memset(isOutside, 0, sizeof(isOutside));
+
+    fprintf(out, "\nstatic uint16_t m_%04x(void)\n{\n", method);
+    // Self tail calls jump back to the start
+    fprintf(out, "L_%04x: ;\n", method);
+    unsigned int pos = method, last = method;
+    for(; pos < end; last = pos, pos += instructionSize(pos))
+    {
+        if(isTarget[pos] && pos != method)
+            fprintf(out, "L_%04x: ;\n", pos);
+        emitInstruction(out, method, end, pos);
+    }
+    // Running into the next method goes on with it, in the frame we have
+    if(fallsThrough(mem[last]))
+    {
+        if(end < externSection)
+            fprintf(out, "    return 0x%04x;\n", end);
+        else
+            fprintf(out, "    vmFault(\"ran past the program\", %d);\n", end);
+    }
+    for(unsigned int target = programSection; target < externSection; target++)
+        if(isOutside[target])
+            fprintf(out, "L_%04x: return 0x%04x;\n", target, target);
+    fprintf(out, "}\n");
+}
+
+static void emit(FILE* out, const char* name)
+{
+    fprintf(out, "// Translated from %s by vm2c\n\n", name);
+    fprintf(out, "#include \"vmrt.h\"\n\n");
+    fprintf(out, "#pragma GCC diagnostic ignored \"-Wunused-label\"\n\n");
+
+    fprintf(out, "static const unsigned char image[%u] =\n{", size);
+    for(unsigned int i = 0; i < size; i++)
+        fprintf(out, "%s0x%02x%s", i % 16 ? " " : "\n    ", mem[i], i + 1 < size ? "," : "\n");
+    fprintf(out, "};\n\n");
+
+    fprintf(out, "static void call(uint16_t method);\n");
+    for(unsigned int pos = programSection; pos < externSection; pos++)
+        if(isMethod[pos])
+            fprintf(out, "static uint16_t m_%04x(void);\n", pos);
+    for(unsigned int pos = programSection; pos < externSection; pos++)
+        if(isMethod[pos])
+            emitMethod(out, pos);
+
+    // Runs a method and whatever it goes on with, until it returns
+    fprintf(out, "\nstatic void call(uint16_t method)\n{\n    while(method)\n    {\n");
+    fprintf(out, "        switch(method)\n        {\n");
+    for(unsigned int pos = programSection; pos < externSection; pos++)
+        if(isMethod[pos])
+            fprintf(out, "        case 0x%04x: method = m_%04x(); break;\n", pos, pos);
+    fprintf(out, "        default: vmFault(\"not a method\", method);\n        }\n    }\n}\n\n");
+
+    fprintf(out, "const VmImage vmImage = { image, sizeof(image), 0x%04x, 0x%04x, 0x%04x, call };\n",
+            entryObject, entryPoint, externSection);
+}
+
+int main(int argc, char* argv[])
+{
+    if(argc != 2)
+    {
+        fprintf(stderr, "usage: vm2c image > image.c\n");
+        return 1;
+    }
+    FILE* in = fopen(argv[1], "rb");
+    if(!in)
+    {
+        perror(argv[1]);
+        return 1;
+    }
+    unsigned char header[8];
+    if(fread(header, 1, sizeof(header), in) != sizeof(header))
+        error(0, "no header");
+    size = fread(mem, 1, sizeof(mem), in);
+    if(fgetc(in) != EOF)
+        error(size, "image larger than VM memory");
+    fclose(in);
+
+    // As in loadProgramSegment(), the offsets are into memory after the header
+    entryObject = header[0] | header[1] << 8;
+    programSection = header[2] | header[3] << 8;
+    entryPoint = header[4] | header[5] << 8;
+    externSection = header[6] | header[7] << 8;
+    if(programSection > externSection || externSection > size)
+        error(externSection, "bad sections");
+    if(entryPoint < programSection || entryPoint >= externSection)
+        error(entryPoint, "entry point outside the program");
+
+    scan();
+    if(!isInstruction[entryPoint])
+        error(entryPoint, "entry point is not an instruction");
+    emit(stdout, argv[1]);
+    return 0;
+}
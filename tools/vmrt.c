@@ -0,0 +1,487 @@
+#include "vmrt.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+// Host side of a program translated by vm2c: the kernel, reduced to a queue of messages
+// in simulated time, and the externs of vm.c, dsp.c, led.c and uart.c working on VM
+// addresses. Build with
+//     vm2c program.bin > program.c
+//     cc -O2 -o program program.c vmrt.c
+// and run the program for some simulated seconds with ./program [seconds]
+
+#define VM_MAX_ARGSIZE 64 // as in vm.h
+#define VM_NMSGS 256
+
+#define PORTB 0x25
+#define LED_BIT 7
+
+unsigned char mem[VM_MEMORY_SIZE];
+unsigned char vmIo[VM_IOSIZE];
+uint16_t sp, fp;
+
+typedef struct
+{
+    int64_t baseline; // Simulated time in microseconds
+    int64_t deadline;
+    unsigned long seq; // Order of sending, among equal deadlines
+    uint16_t obj;
+    uint16_t method;
+    unsigned char argSize;
+    unsigned char argStack[VM_MAX_ARGSIZE];
+} VmMsg;
+
+static VmMsg msgs[VM_NMSGS];
+static int nMsgs;
+static unsigned long nSent;
+static int64_t now;
+static int64_t currentBaseline;
+static uint16_t self;
+static uint16_t stackTop;
+static uint16_t poolSection = VM_MEMORY_SIZE; // As in vm.c, pools are carved from the end
+static uint16_t pools;
+
+// Uart callback set by the program, nothing calls it on the host
+static uint16_t callbackBuf, callbackObj, callbackMeth;
+
+void vmFault(const char* what, uint16_t addr)
+{
+    fprintf(stderr, "%lld.%06lld: %s (%04x)\n", (long long) now/1000000, (long long) now%1000000, what, addr);
+    exit(1);
+}
+
+static void send(int64_t baseline, int64_t deadline, uint16_t obj, uint16_t method, const void* args, unsigned char argSize)
+{
+    if(nMsgs == VM_NMSGS)
+        vmFault("message queue full", method);
+    VmMsg* m = &msgs[nMsgs++];
+    m->baseline = baseline;
+    m->deadline = deadline;
+    m->seq = nSent++;
+    m->obj = obj;
+    m->method = method;
+    m->argSize = argSize;
+    memcpy(m->argStack, args, argSize);
+}
+
+// Next message to run: the one with the earliest deadline of those whose baseline has
+// passed, moving the time forward to the earliest baseline if none has. None if that
+// would be after end
+static bool nextMsg(VmMsg* msg, int64_t end)
+{
+    if(!nMsgs)
+        return false;
+    int64_t first = msgs[0].baseline;
+    for(int i = 1; i < nMsgs; i++)
+        if(msgs[i].baseline < first)
+            first = msgs[i].baseline;
+    if(first > end)
+        return false;
+    if(first > now)
+        now = first;
+    int best = -1;
+    for(int i = 0; i < nMsgs; i++)
+    {
+        if(msgs[i].baseline > now)
+            continue;
+        if(best < 0 || msgs[i].deadline < msgs[best].deadline
+           || (msgs[i].deadline == msgs[best].deadline && msgs[i].seq < msgs[best].seq))
+            best = i;
+    }
+    *msg = msgs[best];
+    msgs[best] = msgs[--nMsgs];
+    return true;
+}
+
+// Like exec() with a new thread. Every message runs on the same stack, since only one runs
+// at a time
+static void run(VmMsg* msg)
+{
+    sp = stackTop;
+    sp -= msg->argSize;
+    memcpy(mem + sp, msg->argStack, msg->argSize);
+    pushInt(0); // fake return address
+    pushInt(0); // fake old frame pointer
+    fp = sp;
+    self = msg->obj;
+    currentBaseline = msg->baseline;
+    vmImage.call(msg->method);
+}
+
+void vmSync(uint16_t obj, uint16_t method)
+{
+    // Nobody else can hold the object, so this is always the stackless SYNC of vm.c, the
+    // frame having been pushed already
+    uint16_t caller = self;
+    self = obj;
+    vmImage.call(method);
+    self = caller;
+}
+
+void vmAsync(void)
+{
+    unsigned char argSize = popChar();
+    int64_t baseline = currentBaseline + popLong();
+    int32_t deadline = popLong();
+    uint16_t obj = popInt();
+    uint16_t method = popInt();
+    if(argSize > VM_MAX_ARGSIZE)
+        vmFault("too many arguments", method);
+    vmCheck(sp, argSize);
+    send(baseline, deadline > 0 ? baseline + deadline : INT64_MAX, obj, method, mem + sp, argSize);
+    sp += argSize;
+}
+
+void vmTailCall(unsigned char newSize, unsigned char oldSize)
+{
+    // As tailCall() in vm.c
+    uint16_t oldFp = getInt(fp);
+    uint16_t retAddr = getInt(fp + 2);
+    uint16_t frame = fp + oldSize - newSize;
+    vmCheck(sp, newSize);
+    vmCheck(frame + 4, newSize);
+    memmove(mem + frame + 4, mem + sp, newSize);
+    setInt(frame, oldFp);
+    setInt(frame + 2, retAddr);
+    fp = sp = frame;
+}
+
+// Is [addr, addr + length) inside VM memory?
+static bool inVmMemory(uint16_t addr, uint16_t length)
+{
+    return length <= VM_MEMORY_SIZE && addr <= VM_MEMORY_SIZE - length;
+}
+
+static int16_t saturate(int32_t l)
+{
+    if(l > 32767)
+        return 32767;
+    if(l < -32768)
+        return -32768;
+    return l;
+}
+
+static int32_t hostMemcpy(uint16_t args)
+{
+    uint16_t dst = getInt(args), src = getInt(args + 2), length = getInt(args + 4);
+    if(inVmMemory(dst, length) && inVmMemory(src, length))
+        memmove(mem + dst, mem + src, length);
+    return 0;
+}
+
+static int32_t hostMemset(uint16_t args)
+{
+    uint16_t dst = getInt(args), length = getInt(args + 3);
+    if(inVmMemory(dst, length))
+        memset(mem + dst, getChar(args + 2), length);
+    return 0;
+}
+
+static int32_t hostMemcmp(uint16_t args)
+{
+    uint16_t a = getInt(args), b = getInt(args + 2), length = getInt(args + 4);
+    if(!inVmMemory(a, length) || !inVmMemory(b, length))
+        return 0;
+    // The difference of the first bytes that differ, as avr-libc returns
+    for(uint16_t i = 0; i < length; i++)
+        if(mem[a + i] != mem[b + i])
+            return mem[a + i] - mem[b + i];
+    return 0;
+}
+
+static int32_t hostMemchr(uint16_t args)
+{
+    uint16_t pos = getInt(args), length = getInt(args + 3);
+    unsigned char c = getChar(args + 2);
+    if(inVmMemory(pos, length))
+        for(uint16_t i = 0; i < length; i++)
+            if(mem[pos + i] == c)
+                return pos + i;
+    return 0;
+}
+
+static int32_t hostMacQ15(uint16_t args)
+{
+    uint16_t a = getInt(args), b = getInt(args + 2);
+    int16_t n = getInt(args + 4);
+    int32_t acc = 0;
+    if(n > 0 && inVmMemory(a, n*2) && inVmMemory(b, n*2))
+        for(int i = 0; i < n; i++)
+            acc += (int32_t) getInt(a + 2*i)*getInt(b + 2*i);
+    return acc;
+}
+
+static int32_t hostMacQ7(uint16_t args)
+{
+    uint16_t a = getInt(args), b = getInt(args + 2);
+    int16_t n = getInt(args + 4);
+    int32_t acc = 0;
+    if(n > 0 && inVmMemory(a, n) && inVmMemory(b, n))
+        for(int i = 0; i < n; i++)
+            acc += getChar(a + i)*getChar(b + i);
+    return acc;
+}
+
+static int32_t hostFirQ15(uint16_t args)
+{
+    uint16_t ring = getInt(args), coeffs = getInt(args + 6);
+    int16_t size = getInt(args + 2), pos = getInt(args + 4), taps = getInt(args + 8);
+    int32_t acc = 0;
+    if(size > 0 && taps > 0 && pos >= 0 && pos < size
+       && inVmMemory(ring, size*2) && inVmMemory(coeffs, taps*2))
+    {
+        for(int i = 0; i < taps; i++)
+        {
+            acc += (int32_t) getInt(coeffs + 2*i)*getInt(ring + 2*pos);
+            if(--pos < 0)
+                pos = size - 1;
+        }
+    }
+    return saturate(acc >> 15);
+}
+
+static int32_t hostSum(uint16_t args)
+{
+    uint16_t a = getInt(args);
+    int16_t n = getInt(args + 2);
+    int32_t sum = 0;
+    if(n > 0 && inVmMemory(a, n*2))
+        for(int i = 0; i < n; i++)
+            sum += getInt(a + 2*i);
+    return sum;
+}
+
+static int32_t hostMin(uint16_t args)
+{
+    uint16_t a = getInt(args);
+    int16_t n = getInt(args + 2);
+    int16_t min = 32767;
+    if(n > 0 && inVmMemory(a, n*2))
+        for(int i = 0; i < n; i++)
+            if(getInt(a + 2*i) < min)
+                min = getInt(a + 2*i);
+    return min;
+}
+
+static int32_t hostMax(uint16_t args)
+{
+    uint16_t a = getInt(args);
+    int16_t n = getInt(args + 2);
+    int16_t max = -32768;
+    if(n > 0 && inVmMemory(a, n*2))
+        for(int i = 0; i < n; i++)
+            if(getInt(a + 2*i) > max)
+                max = getInt(a + 2*i);
+    return max;
+}
+
+static int32_t hostMean(uint16_t args)
+{
+    int16_t n = getInt(args + 2);
+    return n > 0 ? hostSum(args)/n : 0;
+}
+
+static int32_t hostScale(uint16_t args)
+{
+    uint16_t dst = getInt(args), src = getInt(args + 2);
+    int16_t n = getInt(args + 4), gain = getInt(args + 6);
+    int8_t shift = getChar(args + 8) & 31;
+    if(n > 0 && inVmMemory(dst, n*2) && inVmMemory(src, n*2))
+        for(int i = 0; i < n; i++)
+            setInt(dst + 2*i, saturate(((int32_t) getInt(src + 2*i)*gain) >> shift));
+    return 0;
+}
+
+static void printTime(void)
+{
+    printf("%lld.%06lld: ", (long long) now/1000000, (long long) now%1000000);
+}
+
+// The led is PORTB7 as on the board, so IN and OUT see the same register
+static void printLed(void)
+{
+    printTime();
+    printf("led %s\n", vmIo[PORTB] & (1 << LED_BIT) ? "on" : "off");
+}
+
+static int32_t hostToggleLed(uint16_t args)
+{
+    (void) args;
+    vmIo[PORTB] ^= 1 << LED_BIT;
+    printLed();
+    return 0;
+}
+
+static int32_t hostSetLed(uint16_t args)
+{
+    // 0 turns it on, as in vmSetLed
+    if(getChar(args) == 0)
+        vmIo[PORTB] |= 1 << LED_BIT;
+    else
+        vmIo[PORTB] &= ~(1 << LED_BIT);
+    printLed();
+    return 0;
+}
+
+static int32_t hostSetUartCallback(uint16_t args)
+{
+    callbackBuf = getInt(args);
+    callbackObj = getInt(args + 2);
+    callbackMeth = getInt(args + 4);
+    return 0;
+}
+
+static int32_t hostUartTransmit(uint16_t args)
+{
+    int8_t length = getChar(args);
+    uint16_t buf = getInt(args + 1);
+    printTime();
+    printf("uart");
+    for(int i = 0; i < length; i++)
+        printf(" %02x", (unsigned char) getChar(buf + i));
+    printf("\n");
+    return 0;
+}
+
+// The pools of vm.c, with the VmPool fields at the same offsets: next, free, blockSize,
+// count, used, peak and then the blocks. The one stack we run on is below them all
+static bool isPool(uint16_t pool)
+{
+    for(uint16_t p = pools; p; p = getInt(p))
+        if(p == pool)
+            return true;
+    return false;
+}
+
+static int32_t hostPoolCreate(uint16_t args)
+{
+    uint16_t blockSize = getInt(args), count = getInt(args + 2);
+    if(blockSize < 2)
+        blockSize = 2;
+    uint32_t size = 12 + (uint32_t) blockSize*count;
+    if(!count || size > (uint32_t) (poolSection - stackTop))
+        return 0;
+    poolSection -= size;
+    uint16_t pool = poolSection;
+    setInt(pool, pools);
+    setInt(pool + 2, pool + 12);
+    setInt(pool + 4, blockSize);
+    setInt(pool + 6, count);
+    setInt(pool + 8, 0);
+    setInt(pool + 10, 0);
+    for(uint16_t i = 0; i < count; i++)
+        setInt(pool + 12 + i*blockSize, i + 1 < count ? pool + 12 + (i + 1)*blockSize : 0);
+    pools = pool;
+    return pool;
+}
+
+static int32_t hostPoolAlloc(uint16_t args)
+{
+    uint16_t pool = getInt(args);
+    if(!isPool(pool) || !getInt(pool + 2))
+        return 0;
+    uint16_t block = getInt(pool + 2);
+    setInt(pool + 2, getInt(block));
+    uint16_t used = getInt(pool + 8) + 1;
+    setInt(pool + 8, used);
+    if(used > (uint16_t) getInt(pool + 10))
+        setInt(pool + 10, used);
+    return block;
+}
+
+static int32_t hostPoolFree(uint16_t args)
+{
+    uint16_t pool = getInt(args), block = getInt(args + 2);
+    if(!isPool(pool))
+        return 0;
+    uint16_t blockSize = getInt(pool + 4), count = getInt(pool + 6);
+    if(block < pool + 12 || block >= pool + 12 + (uint32_t) blockSize*count || (block - pool - 12) % blockSize
+       || !getInt(pool + 8))
+        return 0;
+    // Already free, as in vmPoolFree
+    for(uint16_t next = getInt(pool + 2); next; next = getInt(next))
+        if(next == block)
+            return 0;
+    setInt(block, getInt(pool + 2));
+    setInt(pool + 2, block);
+    setInt(pool + 8, getInt(pool + 8) - 1);
+    return 0;
+}
+
+static int32_t hostPoolUsage(uint16_t args)
+{
+    uint16_t pool = getInt(args);
+    if(!isPool(pool))
+        return 0;
+    return (int32_t) ((uint32_t) (uint16_t) getInt(pool + 10) << 16 | (uint16_t) getInt(pool + 8));
+}
+
+typedef struct
+{
+    int32_t (*fn)(uint16_t args);
+    unsigned char argSize; // Sizes on the device
+    unsigned char retSize;
+} HostExtern;
+
+// In the order of the extern IDs in vm.h
+static const HostExtern hostExterns[] =
+{
+    { hostMemcpy, 6, 0 },
+    { hostMemset, 5, 0 },
+    { hostMemcmp, 6, 2 },
+    { hostMemchr, 5, 2 },
+    { hostMacQ15, 6, 4 },
+    { hostMacQ7, 6, 4 },
+    { hostFirQ15, 10, 2 },
+    { hostSum, 4, 4 },
+    { hostMin, 4, 2 },
+    { hostMax, 4, 2 },
+    { hostMean, 4, 2 },
+    { hostScale, 9, 0 },
+    { hostToggleLed, 0, 0 },
+    { hostSetLed, 1, 0 },
+    { hostSetUartCallback, 6, 0 },
+    { hostUartTransmit, 3, 0 },
+    { hostPoolCreate, 4, 2 },
+    { hostPoolAlloc, 2, 2 },
+    { hostPoolFree, 4, 0 },
+    { hostPoolUsage, 2, 4 }
+};
+
+void vmCallExtern(uint16_t id)
+{
+    if(id >= sizeof(hostExterns)/sizeof(*hostExterns))
+        vmFault("no such extern", id);
+    const HostExtern* ext = &hostExterns[id];
+    int32_t result = ext->fn(sp);
+    sp += ext->argSize;
+    switch(ext->retSize)
+    {
+    case 1: pushChar(result); break;
+    case 2: pushInt(result); break;
+    case 4: pushLong(result); break;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    int64_t end = argc > 1 ? (int64_t) (atof(argv[1])*1000000) : INT64_MAX;
+    unsigned long nRun = 0;
+    memcpy(mem, vmImage.image, vmImage.size);
+
+    // A stack of an even share of the memory after the program, as vm.c gives recursive
+    // programs. Only one message runs at a time, so it's the only one
+    stackTop = vmImage.externSection + (VM_MEMORY_SIZE - vmImage.externSection)/VM_NSHARES;
+
+    send(0, INT64_MAX, vmImage.entryObject, vmImage.entryPoint, 0, 0);
+    VmMsg msg;
+    while(nextMsg(&msg, end))
+    {
+        run(&msg);
+        nRun++;
+    }
+    if(end > now && end < INT64_MAX)
+        now = end;
+    printTime();
+    printf("%lu messages, %d pending\n", nRun, nMsgs);
+    return 0;
+}
@@ -0,0 +1,114 @@
+#ifndef VMRT_H
+#define VMRT_H
+
+// Host runtime for programs translated to C by vm2c. VM memory is an array of the same
+// size as on the device and VM addresses are offsets into it, so everything a program
+// keeps in memory (frames, pointers, objects) looks like it does there, only relative
+// to mem instead of absolute. Messages run to completion in simulated time, one at a
+// time, the way the kernel would run them with nothing else going on
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#define VM_MEMORY_SIZE 3500 // as in vm.h
+#define VM_NSHARES 4       // as in vm.h
+#define VM_IOSIZE 0x200     // data space addresses of the I/O registers
+
+extern unsigned char mem[VM_MEMORY_SIZE];
+extern unsigned char vmIo[VM_IOSIZE];
+extern uint16_t sp, fp;
+
+// What vm2c puts in the translated program
+typedef struct
+{
+    const unsigned char* image; // memory after the header
+    uint16_t size;
+    uint16_t entryObject;
+    uint16_t entryPoint;
+    uint16_t externSection;
+    void (*call)(uint16_t method); // runs the method at an address
+} VmImage;
+
+extern const VmImage vmImage;
+
+void vmFault(const char* what, uint16_t addr) __attribute__((noreturn));
+void vmSync(uint16_t obj, uint16_t method);
+void vmAsync(void);
+void vmCallExtern(uint16_t id);
+void vmTailCall(unsigned char newSize, unsigned char oldSize);
+
+static inline void vmCheck(uint16_t addr, uint16_t length)
+{
+    if(addr > VM_MEMORY_SIZE - length)
+        vmFault("access outside VM memory", addr);
+}
+
+static inline int8_t getChar(uint16_t addr)
+{
+    vmCheck(addr, 1);
+    return (int8_t) mem[addr];
+}
+
+static inline int16_t getInt(uint16_t addr)
+{
+    int16_t i;
+    vmCheck(addr, 2);
+    memcpy(&i, mem + addr, 2);
+    return i;
+}
+
+static inline int32_t getLong(uint16_t addr)
+{
+    int32_t l;
+    vmCheck(addr, 4);
+    memcpy(&l, mem + addr, 4);
+    return l;
+}
+
+static inline void setChar(uint16_t addr, int8_t c)
+{
+    vmCheck(addr, 1);
+    mem[addr] = (unsigned char) c;
+}
+
+static inline void setInt(uint16_t addr, int16_t i)
+{
+    vmCheck(addr, 2);
+    memcpy(mem + addr, &i, 2);
+}
+
+static inline void setLong(uint16_t addr, int32_t l)
+{
+    vmCheck(addr, 4);
+    memcpy(mem + addr, &l, 4);
+}
+
+static inline int8_t popChar(void) { sp += 1; return getChar(sp - 1); }
+static inline int16_t popInt(void) { sp += 2; return getInt(sp - 2); }
+static inline int32_t popLong(void) { sp += 4; return getLong(sp - 4); }
+static inline void pushChar(int8_t c) { sp -= 1; setChar(sp, c); }
+static inline void pushInt(int16_t i) { sp -= 2; setInt(sp, i); }
+static inline void pushLong(int32_t l) { sp -= 4; setLong(sp, l); }
+
+// Shift counts are chars on the device, the ones the host can't shift by in one go
+// saturate instead of being undefined
+static inline uint32_t vmShl(uint32_t v, int8_t n) { return n <= 0 ? v : n > 31 ? 0 : v << n; }
+static inline uint32_t vmShr(uint32_t v, int8_t n) { return n <= 0 ? v : n > 31 ? 0 : v >> n; }
+static inline int32_t vmSar(int32_t v, int8_t n) { return n <= 0 ? v : v >> (n > 31 ? 31 : n); }
+
+static inline void vmOut(uint16_t addr, int8_t mask, int8_t value)
+{
+    vmIo[addr] = (vmIo[addr] & ~mask) | (value & mask);
+}
+
+// The translation of the arithmetic opcodes, [$sp] being the left operand as in vm.c.
+// Everything is done in types wide enough not to overflow on the host, and truncated
+// to the size of the operands when pushed
+#define BINARY(type, pop, push, op) do { type a = pop(); type b = pop(); push(a op b); } while(0)
+#define DIVIDE(pop, push, op, pc) \
+    do { int64_t a = pop(); int64_t b = pop(); if(!b) vmFault("division by zero", pc); push(a op b); } while(0)
+#define COMPARE(type, pop, op) do { type a = pop(); type b = pop(); pushChar(a op b); } while(0)
+#define COND(type, pop, op) ({ type a = pop(); type b = pop(); a op b; })
+
+#endif
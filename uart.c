@@ -23,6 +23,43 @@ void sendAck(Uart* self, int confirmedReceived)
     transmit(self, 1, sendBuf + sizeof(sendBuf) - 1);
 }
 
+void sendExternInfo(Uart* self, unsigned char index)
+{
+    // Index and number of externs, followed by the ID, name hash, argument size and return
+    // size of the extern if there is one at that index. One extern per frame so that it
+    // fits in the transmission buffer, the host asks for them one by one
+    unsigned char sendBuf[19] = { FRAME_DELIMITER, QUERY_HEADER, index, VM_NEXTERNS };
+    int length = 4;
+    if(index < VM_NEXTERNS)
+    {
+        const VmExternEntry* entry = &vmExternRegistry[index];
+        const VmExtern* ext = (const VmExtern*) pgm_read_word(&entry->ext);
+        *((unsigned int*) (&sendBuf[length])) = pgm_read_word(&entry->id);
+        *((unsigned long*) (&sendBuf[length + 2])) = pgm_read_dword(&entry->hash);
+        sendBuf[length + 6] = pgm_read_byte(&ext->argSize);
+        sendBuf[length + 7] = pgm_read_byte(&ext->retSize);
+        length += 8;
+    }
+    unsigned long chkSum = 0;
+    for(int i = 1; i < length; i++)
+        chkSum += sendBuf[i];
+    *((unsigned long*) (&sendBuf[length])) = chkSum;
+    sendBuf[length + 4] = FRAME_DELIMITER;
+    transmit(self, 1, sendBuf);
+    transmitChecked(self, length + 3, sendBuf + 1);
+    transmit(self, 1, sendBuf + length + 4);
+}
+
+void sendReject(Uart* self, unsigned char reason)
+{
+    unsigned char sendBuf[] = { FRAME_DELIMITER, REJECT_HEADER, reason, 0, 0, 0, 0, FRAME_DELIMITER };
+    unsigned long chkSum = sendBuf[1] + sendBuf[2];
+    *((unsigned long*) (&sendBuf[3])) = chkSum;
+    transmit(self, 1, sendBuf);
+    transmitChecked(self, sizeof(sendBuf) - 2, sendBuf + 1);
+    transmit(self, 1, sendBuf + sizeof(sendBuf) - 1);
+}
+
 void addToChecksum(unsigned long *checksum, unsigned char byteToAdd)
 {
     *checksum += byteToAdd;
@@ -30,11 +67,10 @@ void addToChecksum(unsigned long *checksum, unsigned char byteToAdd)
 
 int handleCompleteAppFrame(Uart* self)
 {
-    cli();
-    VmArgBin* argBin = popVmArgBin();
-    sei();
     unsigned char argStack[] = { self->pBuf - 1};
-    argBin->argSize = sizeof(argStack);
+    VmArgBin* argBin = allocVmArgBin(sizeof(argStack));
+    if(!argBin)
+        return 0; // No room for the message, the frame is dropped
     memcpy(argBin->argStack, argStack, argBin->argSize);
     argBin->methodAddr = self->callbackMeth;
     memcpy(self->callbackBuf, self->frameBuffer + 1, self->pBuf - 1);
@@ -199,6 +235,10 @@ int handleReceivedByte(Uart* self, int arg)
         case RESET_HEADER:
             soft_reset();
             break;
+        case QUERY_HEADER:
+            if(self->pBuf >= 2)
+                sendExternInfo(self, self->frameBuffer[1]);
+            break;
         default:
             handleCompleteAppFrame(self);
             break;
@@ -252,39 +292,25 @@ void setupUart()
     UCSR0C = (1 << UCSZ00) | (1 << UCSZ01);
 }
 
-int lockedTransmit(Uart* self, int arg)
+long vmTransmit(Object* self, void* args)
 {
-    VmThread* thread = (VmThread*) arg;
-
+    // Called with the uart locked
+    TransmitArgs* a = args;
     unsigned char header[] = { FRAME_DELIMITER, 0x00 };
     unsigned char footer[] = { FRAME_DELIMITER };
-    char length = getChar(thread->fp + 4);
-    unsigned char* buf = (unsigned char*) getPtr(thread->fp + 5);
-    
-    transmit(self, sizeof(header), header);
-    transmitChecked(self, length, buf);
-    transmit(self, sizeof(footer), footer);
     
-    thread->sp = thread->fp + 7;
+    transmit((Uart*) self, sizeof(header), header);
+    transmitChecked((Uart*) self, a->length, a->buf);
+    transmit((Uart*) self, sizeof(footer), footer);
     return 0;
 }    
 
-void vmTransmit(VmThread* thread)
+long vmSetCallback(Object* self, void* args)
 {
-    SYNC(&uart, lockedTransmit, (int) thread);
-}
-
-int setCallback(Uart* self, int arg)
-{
-    VmThread* thread = (VmThread*) arg;
-    self->callbackMeth = getPtr(thread->fp + 8);
-    self->callbackObj = (Object*) getPtr(thread->fp + 6);
-    self->callbackBuf = getPtr(thread->fp + 4);
-    thread->sp = thread->fp + 10;
+    // Called with the uart locked
+    SetCallbackArgs* a = args;
+    ((Uart*) self)->callbackMeth = a->meth;
+    ((Uart*) self)->callbackObj = a->obj;
+    ((Uart*) self)->callbackBuf = a->buf;
     return 0;
-}
-    
-void vmSetCallback(VmThread* thread)
-{
-    SYNC(&uart, setCallback, (int) thread);
 }
\ No newline at end of file
@@ -15,6 +15,8 @@
 #define MORESEND_HEADER 0x0B
 #define ACK_HEADER      0x0C
 #define RESET_HEADER    0x0D
+#define QUERY_HEADER    0x0E // Host asks for entry n of the extern registry
+#define REJECT_HEADER   0x0F // A received program won't run, with a VM_REJECT_* reason
 
 #define UART_RB_SIZE 256
 #define UART_TB_SIZE 64 // Must be <= 256
@@ -55,11 +57,25 @@ extern Uart uart;
 
 int transmit(Uart* self, unsigned int length, unsigned char* buffer);
 int transmitChecked(Uart* self, unsigned int length, unsigned char* buffer);
+void sendReject(Uart* self, unsigned char reason);
 int uartReceiveInterrupt(Uart* self, int arg);
 int uartSentInterrupt(Uart* self, int arg);
 void setupUart();
 
-void vmTransmit(VmThread* thread);
-void vmSetCallback(VmThread* thread);
+typedef struct
+{
+    char length;
+    unsigned char* buf;
+} TransmitArgs;
+
+typedef struct
+{
+    void* buf;
+    Object* obj;
+    void* meth;
+} SetCallbackArgs;
+
+long vmTransmit(Object* self, void* args);
+long vmSetCallback(Object* self, void* args);
 
 #endif
\ No newline at end of file
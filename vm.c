@@ -3,6 +3,7 @@
 
 #include "led.h"
 #include "uart.h"
+#include "dsp.h"
 
 #include <avr/interrupt.h>
 #include <stdbool.h>
@@ -14,6 +15,7 @@ void* entryObject;
 void* programSection;
 void* entryPoint;
 void* externSection;
+void* freeSection;
 
 const unsigned PROGMEM char instructionLength[] =
 {   
@@ -104,53 +106,485 @@ const unsigned PROGMEM char instructionLength[] =
     2, // OP_SRADWORD
     1, // OP_SRAVBYTE
     1, // OP_SRAVWORD
-    1  // OP_SRAVDWORD
+    1, // OP_SRAVDWORD
+    10, // OP_ADDWORDFPFP
+    10, // OP_SUBWORDFPFP
+    10, // OP_ADDWORDFPIMM
+    6, // OP_PUSH2WORDFP
+    6, // OP_MOVWORDFP
+    6, // OP_MOVWORDIMMFP
+    1, // OP_SLTBYTE
+    1, // OP_SLTWORD
+    1, // OP_SLTDWORD
+    1, // OP_SLEBYTE
+    1, // OP_SLEWORD
+    1, // OP_SLEDWORD
+    1, // OP_SEQBYTE
+    1, // OP_SEQWORD
+    1, // OP_SEQDWORD
+    1, // OP_SNEBYTE
+    1, // OP_SNEWORD
+    1, // OP_SNEDWORD
+    1, // OP_SLTUBYTE
+    1, // OP_SLTUWORD
+    1, // OP_SLTUDWORD
+    1, // OP_SLEUBYTE
+    1, // OP_SLEUWORD
+    1, // OP_SLEUDWORD
+    3, // OP_JLTBYTE
+    3, // OP_JLTWORD
+    3, // OP_JLTDWORD
+    3, // OP_JGEBYTE
+    3, // OP_JGEWORD
+    3, // OP_JGEDWORD
+    3, // OP_JEQBYTE
+    3, // OP_JEQWORD
+    3, // OP_JEQDWORD
+    3, // OP_JNEBYTE
+    3, // OP_JNEWORD
+    3, // OP_JNEDWORD
+    3, // OP_JLTUBYTE
+    3, // OP_JLTUWORD
+    3, // OP_JLTUDWORD
+    3, // OP_JGEUBYTE
+    3, // OP_JGEUWORD
+    3, // OP_JGEUDWORD
+    2, // OP_ADDBYTEIMM
+    3, // OP_ADDWORDIMM
+    5, // OP_ADDDWORDIMM
+    2, // OP_SUBBYTEIMM
+    3, // OP_SUBWORDIMM
+    5, // OP_SUBDWORDIMM
+    2, // OP_ANDBYTEIMM
+    3, // OP_ANDWORDIMM
+    5, // OP_ANDDWORDIMM
+    2, // OP_ORBYTEIMM
+    3, // OP_ORWORDIMM
+    5, // OP_ORDWORDIMM
+    2, // OP_XORBYTEIMM
+    3, // OP_XORWORDIMM
+    5, // OP_XORDWORDIMM
+    2, // OP_MULBYTEIMM
+    3, // OP_MULWORDIMM
+    5, // OP_MULDWORDIMM
+    4, // OP_INCBYTEFP
+    5, // OP_INCWORDFP
+    7, // OP_INCDWORDFP
+    4, // OP_PUSHBYTEADDRIDX
+    4, // OP_PUSHWORDADDRIDX
+    4, // OP_PUSHDWORDADDRIDX
+    4, // OP_PUSHBYTEFPIDX
+    4, // OP_PUSHWORDFPIDX
+    4, // OP_PUSHDWORDFPIDX
+    3, // OP_PUSHBYTEDISP
+    3, // OP_PUSHWORDDISP
+    3, // OP_PUSHDWORDDISP
+    4, // OP_POPBYTEADDRIDX
+    4, // OP_POPWORDADDRIDX
+    4, // OP_POPDWORDADDRIDX
+    4, // OP_POPBYTEFPIDX
+    4, // OP_POPWORDFPIDX
+    4, // OP_POPDWORDFPIDX
+    3, // OP_POPBYTEDISP
+    3, // OP_POPWORDDISP
+    3, // OP_POPDWORDDISP
+    2, // OP_PUSHFPS
+    2, // OP_PUSHBYTEFPS
+    2, // OP_PUSHWORDFPS
+    2, // OP_PUSHDWORDFPS
+    2, // OP_POPBYTEFPS
+    2, // OP_POPWORDFPS
+    2, // OP_POPDWORDFPS
+    2, // OP_PUSHWORDIMMS
+    2, // OP_PUSHDWORDIMMS
+    2, // OP_PUSHIMMS
+    2, // OP_POPIMMS
+    1, // OP_PUSHWORDLOC0
+    1, // OP_PUSHWORDLOC1
+    1, // OP_PUSHWORDLOC2
+    1, // OP_PUSHWORDLOC3
+    1, // OP_POPWORDLOC0
+    1, // OP_POPWORDLOC1
+    1, // OP_POPWORDLOC2
+    1, // OP_POPWORDLOC3
+    1, // OP_PUSHWORDARG0
+    1, // OP_PUSHWORDARG1
+    2, // OP_JMPS
+    2, // OP_JEZS
+    2, // OP_JNEZS
+    0, // OP_TABLESWITCH
+    4, // OP_IN
+    4, // OP_OUT
+    4, // OP_SBI
+    4, // OP_CBI
+    5, // OP_DJNZWORDFP
+    5, // OP_TAILCALL
+    1, // OP_SLEEP
+    1, // OP_AWAIT
+    1, // OP_NOTIFY
+    2, // OP_HOT
+    2, // OP_NATIVE
+    2, // OP_CHSEND
+    2, // OP_CHRECV
+    1, // OP_ASYNCF
+    1, // OP_FPOLL
+    1  // OP_FAWAIT
 };
 
+typedef struct
+{
+    unsigned char fused;
+    unsigned char ops[4];
+} FusionRule;
+
+// Sequences replaced by superinstructions, longest first since the first match wins
+const PROGMEM FusionRule fusionRules[] =
+{
+    { OP_ADDWORDFPFP, { OP_PUSHWORDFP, OP_PUSHWORDFP, OP_ADDWORD, OP_POPWORDFP } },
+    { OP_SUBWORDFPFP, { OP_PUSHWORDFP, OP_PUSHWORDFP, OP_SUBWORD, OP_POPWORDFP } },
+    { OP_ADDWORDFPIMM, { OP_PUSHWORDFP, OP_PUSHWORDIMM, OP_ADDWORD, OP_POPWORDFP } },
+    { OP_PUSH2WORDFP, { OP_PUSHWORDFP, OP_PUSHWORDFP } },
+    { OP_MOVWORDFP, { OP_PUSHWORDFP, OP_POPWORDFP } },
+    { OP_MOVWORDIMMFP, { OP_PUSHWORDIMM, OP_POPWORDFP } }
+};
+
+typedef struct
+{
+    unsigned int addr;
+    unsigned char readMask;
+    unsigned char writeMask;
+} IoPermission;
+
+// I/O registers and bits that programs may access directly through IN, OUT, SBI and CBI.
+// PINB is read only since writing ones to it toggles the port pins
+const PROGMEM IoPermission ioWhitelist[] =
+{
+    { _SFR_MEM_ADDR(PORTB), 1 << 7, 1 << 7 },
+    { _SFR_MEM_ADDR(DDRB), 1 << 7, 1 << 7 },
+    { _SFR_MEM_ADDR(PINB), 1 << 7, 0 }
+};
+
+// Where rejected I/O accesses end up
+char ioDummy;
+
 char mem[VM_MEMORY_SIZE];
-VmArgBin vmArgBins[VM_NARGBINS];
 VmThread vmThreads[VM_NTHREADS];
 
-VmArgBin* vmArgBinStack = vmArgBins;
 VmThread* vmThreadStack = vmThreads;
+VmArgBin* vmThreadWaiters; // Messages that found no thread or stack, first come first
+
+// Stack sizes from verifyProgram() for the methods that threads start in. They lie in VM
+// memory between the extern section and freeSection, from where on stacks are allocated
+typedef struct
+{
+    char* method;
+    unsigned int size;
+} VmStackHint;
+
+VmStackHint* vmStackHints;
+unsigned char nVmStackHints;
+unsigned int vmDefaultStackSize; // For methods without a hint
+
+// Pools are carved from the end of memory downwards, stacks stay below vmPoolSection
+char* vmPoolSection = mem + VM_MEMORY_SIZE;
+VmPool* vmPools;
+
+// Argument blocks come in size classes for 4, 8, 16, 32 and 64 (VM_MAX_ARGSIZE) bytes of
+// arguments. A freed block goes to the free list of its class and is only ever reused
+// for that class or smaller ones, so the arena can't fragment into pieces too small to use
+#define VM_ARGCLASSES 5
+#define ARGCLASS_SIZE(c) (4 << (c))
+
+char vmArgArena[VM_ARGARENA_SIZE];
+char* vmArgArenaTop = vmArgArena; // Start of the part of the arena never handed out
+VmArgBin* vmArgBinFree[VM_ARGCLASSES];
+
+#ifdef VM_COUNT_CYCLES
+unsigned long vmClassCycles[VM_NCLASSES];
+unsigned long vmClassCount[VM_NCLASSES];
+static unsigned int lastCycle;
+static unsigned char lastClass = VM_NCLASSES; // None, the first dispatch of an exec
+
+static unsigned char opcodeClass(unsigned char opCode)
+{
+    switch(opCode)
+    {
+    case OP_PUSHFP ... OP_POPDWORD:
+    case OP_PUSH2WORDFP ... OP_MOVWORDIMMFP:
+    case OP_PUSHBYTEADDRIDX ... OP_PUSHWORDARG1:
+        return VM_CLASS_STACK;
+    case OP_ADDBYTE ... OP_XORDWORD:
+    case OP_SLLBYTE ... OP_ADDWORDFPIMM:
+    case OP_ADDBYTEIMM ... OP_INCDWORDFP:
+        return VM_CLASS_ARITH;
+    case OP_SGZBYTE ... OP_SNEZDWORD:
+    case OP_SLTBYTE ... OP_SLEUDWORD:
+        return VM_CLASS_COMPARE;
+    case OP_JMP ... OP_JNEZ:
+    case OP_JLTBYTE ... OP_JGEUDWORD:
+    case OP_JMPS ... OP_TABLESWITCH:
+    case OP_DJNZWORDFP:
+        return VM_CLASS_JUMP;
+    case OP_CALL:
+    case OP_RET:
+    case OP_TAILCALL:
+        return VM_CLASS_CALL;
+    case OP_SYNC:
+    case OP_ASYNC:
+    case OP_SLEEP ... OP_NOTIFY:
+    case OP_CHSEND ... OP_FAWAIT:
+        return VM_CLASS_MESSAGE;
+    case OP_CALLE:
+    case OP_IN ... OP_CBI:
+        return VM_CLASS_EXTERN;
+    }
+    return VM_CLASS_OTHER;
+}
+
+// Charges the cycles since the last dispatch to the class of the opcode that ran in
+// between, and starts timing the one at pc
+static inline void countCycles(char* pc)
+{
+    unsigned int now = TCNT3;
+    if(lastClass < VM_NCLASSES)
+    {
+        vmClassCycles[lastClass] += (unsigned int) (now - lastCycle);
+        vmClassCount[lastClass]++;
+    }
+    lastClass = opcodeClass(getChar(pc));
+    lastCycle = TCNT3;
+}
+#endif
+
+#ifdef VM_COUNT_INSTRUCTIONS
+volatile unsigned long vmInstructionCount = 0;
+#define COUNT_INSTRUCTION(pc) vmInstructionCount++
+#elif defined(VM_COUNT_CYCLES)
+#define COUNT_INSTRUCTION(pc) countCycles(pc)
+#else
+#define COUNT_INSTRUCTION(pc)
+#endif
+
+// A thread can only be parked if there's no exec of it left on the C stack and it holds
+// no locks of its own, since those belong to the kernel thread we give up
+#define CAN_PARK(t) ((t)->syncDepth == 0 && (t)->heldLocks == 0)
+
+#if VM_QUANTUM > 0
+#define QUANTUM_EXPIRED() (budget-- == 0 && (budget = VM_QUANTUM, CAN_PARK(thread)))
+#else
+#define QUANTUM_EXPIRED() false
+#endif
 
 void exec(Object* obj, int arg);
 
-VmThread* popVmThread()
+// Lets a thread continue where it is in a new message to its object, after the given
+// baseline offset and with the current relative deadline. Exec picks the thread up from
+// argBin like in a sync call
+void parkVmThread(VmThread* thread, VmArgBin* argBin, Time after)
 {
+    argBin->thread = thread;
+    argBin->methodAddr = thread->pc;
+    SEND(after, CURRENT_DEADLINE(), thread->obj, exec, argBin);
+}
+
+// Queues argBin (with a thread waiting at its methodAddr) on the semaphore at sem, which is
+// a count word followed by the first waiter. Waiters are resumed first come first served
+void addVmWaiter(char* sem, VmArgBin* argBin)
+{
+    argBin->next = 0;
+    VmArgBin* last = getPtr(sem + 2);
+    if(!last)
+        setPtr(sem + 2, argBin);
+    else
+    {
+        while(last->next)
+            last = last->next;
+        last->next = argBin;
+    }
+}
+
+// Offsets in a channel, see OP_CHSEND
+#define CHANNEL_WAITER 0
+#define CHANNEL_HEAD 2
+#define CHANNEL_TAIL 3
+#define CHANNEL_SLOTS 4
+#define CHANNEL_DATA 5
+
+// Offsets in a future, see OP_ASYNCF
+#define FUTURE_STATE 0
+#define FUTURE_WAITER 2
+#define FUTURE_VALUE 4
+
+#define FUTURE_PENDING 0
+#define FUTURE_DONE 1
+#define FUTURE_DROPPED 2
+
+// Stores the result of an ASYNCF call in its future and wakes everyone waiting for it
+void resolveVmFuture(char* future, long value)
+{
+    setLong(future + FUTURE_VALUE, value);
+    char sreg = SREG;
+    cli();
+    setInt(future + FUTURE_STATE, FUTURE_DONE);
+    VmArgBin* waiter = getPtr(future + FUTURE_WAITER);
+    setPtr(future + FUTURE_WAITER, 0);
+    SREG = sreg;
+    while(waiter)
+    {
+        VmArgBin* next = waiter->next;
+        BEFORE(CURRENT_DEADLINE(), waiter->thread->obj, exec, waiter);
+        waiter = next;
+    }
+}
+
+// Undoes the stackless SYNC into the frame we just returned from
+void releaseVmLock(VmThread* thread)
+{
+    VmLock* lock = &thread->locks[--thread->nLocks];
+    if(lock->obj)
+    {
+        UNLOCK(lock->obj);
+        thread->heldLocks--;
+    }
+    thread->obj = lock->prevObj;
+}
+
+static unsigned int stackHint(char* method)
+{
+    for(VmStackHint* hint = vmStackHints; hint < vmStackHints + nVmStackHints; hint++)
+        if(hint->method == method)
+            return hint->size;
+    return vmDefaultStackSize;
+}
+
+// Finds the lowest place from freeSection on where size bytes don't overlap the stack of
+// any thread. There are few enough of those to just try right after each of them
+static char* allocStack(unsigned int size)
+{
+    char* best = 0;
+    for(int i = -1; i < VM_NTHREADS; i++)
+    {
+        char* bottom = i < 0 ? freeSection : vmThreads[i].stack;
+        if(!bottom || vmPoolSection - bottom < size || (best && bottom > best))
+            continue;
+        bool fits = true;
+        for(int j = 0; j < VM_NTHREADS && fits; j++)
+            if(vmThreads[j].bottom)
+                fits = bottom + size <= vmThreads[j].bottom || bottom >= vmThreads[j].stack;
+        if(fits)
+            best = bottom;
+    }
+    return best;
+}
+
+// Hands out a thread with a stack of the size method needs, or 0 if there's no thread or
+// no room for its stack
+VmThread* popVmThread(char* method)
+{
+    unsigned int size = stackHint(method);
+    char sreg = SREG;
     cli();
     VmThread* ret = vmThreadStack;
+    char* bottom = ret ? allocStack(size) : 0;
+    if(!bottom)
+    {
+        SREG = sreg;
+        return 0;
+    }
     vmThreadStack = vmThreadStack->next;
+    ret->bottom = bottom;
+    ret->stack = bottom + size;
     ret->sp = ret->stack;
     ret->fp = ret->sp;
     ret->pc = 0;
+    ret->syncDepth = 0;
+    ret->nLocks = 0;
+    ret->heldLocks = 0;
+    SREG = sreg;
+    return ret;
+}
+
+// popVmThread() for the message argBin to obj, which otherwise waits in vmThreadWaiters
+// until pushVmThread() sends it again. Checking and queueing in one go means no thread can
+// return in between without seeing it
+static VmThread* popVmThreadOrWait(Object* obj, VmArgBin* argBin)
+{
+    cli();
+    VmThread* ret = popVmThread(argBin->methodAddr);
+    if(!ret)
+    {
+        argBin->obj = obj;
+        argBin->next = 0;
+        VmArgBin** last = &vmThreadWaiters;
+        while(*last)
+            last = &(*last)->next;
+        *last = argBin;
+    }
     sei();
     return ret;
 }
 
+// Returns a thread and its stack, and sends every message waiting for them to try again.
+// Those that still find no room wait for the next thread that returns
 void pushVmThread(VmThread* v)
 {
     cli();
+    v->bottom = v->stack = 0;
     v->next = vmThreadStack;
     vmThreadStack = v;
+    VmArgBin* waiter = vmThreadWaiters;
+    vmThreadWaiters = 0;
     sei();
+    while(waiter)
+    {
+        VmArgBin* next = waiter->next;
+        BEFORE(CURRENT_DEADLINE(), waiter->obj, exec, waiter);
+        waiter = next;
+    }
 }
 
-VmArgBin* popVmArgBin()
+// Gets a block for argSize bytes of arguments from the free list of the smallest class
+// they fit in, or else from the untouched part of the arena, or else from a free list of
+// a larger class. Returns 0 if there's no room left
+VmArgBin* allocVmArgBin(unsigned char argSize)
 {
+    if(argSize > VM_MAX_ARGSIZE)
+        return 0;
+    unsigned char sizeClass = 0;
+    while(ARGCLASS_SIZE(sizeClass) < argSize)
+        sizeClass++;
+    
     cli();
-    VmArgBin* ret = vmArgBinStack;
-    vmArgBinStack = vmArgBinStack->next;
-    ret->thread = 0;
+    VmArgBin* ret = vmArgBinFree[sizeClass];
+    if(ret)
+        vmArgBinFree[sizeClass] = ret->next;
+    else if(vmArgArena + VM_ARGARENA_SIZE - vmArgArenaTop >= sizeof(VmArgBin) + ARGCLASS_SIZE(sizeClass))
+    {
+        ret = (VmArgBin*) vmArgArenaTop;
+        ret->sizeClass = sizeClass;
+        vmArgArenaTop += sizeof(VmArgBin) + ARGCLASS_SIZE(sizeClass);
+    }
+    else
+    {
+        while(!ret && ++sizeClass < VM_ARGCLASSES)
+            if((ret = vmArgBinFree[sizeClass]))
+                vmArgBinFree[sizeClass] = ret->next;
+    }
+    if(ret)
+    {
+        ret->thread = 0;
+        ret->future = 0;
+        ret->argSize = argSize;
+    }
     sei();
     return ret;
 }
 
-void pushVmArgBin(VmArgBin* v)
+void freeVmArgBin(VmArgBin* v)
 {
     cli();
-    v->next = vmArgBinStack;
-    vmArgBinStack = v;
+    v->next = vmArgBinFree[v->sizeClass];
+    vmArgBinFree[v->sizeClass] = v;
     sei();
 }
 
@@ -164,10 +598,9 @@ void vmStart()
 
 void vmInit()
 {
-    for(int i = 0; i < VM_NARGBINS - 1; i++)
-        vmArgBinStack[i].next = &(vmArgBinStack[i+1]);
-    vmArgBinStack[VM_NARGBINS-1].next = 0;
-    
+#ifdef VM_COUNT_CYCLES
+    TCCR3B = 1 << CS30; // The CPU clock
+#endif
     for(int i = 0; i < VM_NTHREADS - 1; i++)
         vmThreadStack[i].next = &(vmThreadStack[i+1]);
     vmThreadStack[VM_NTHREADS-1].next = 0;
@@ -277,19 +710,277 @@ inline void popArray(void* data, VmThread* t, int size)
     t->sp += size;
 }
 
-void* getAddrFromName(const char* name)
+// Length of the instruction at pos, this is what code walking the program should use
+int instructionSize(void* pos)
+{
+    unsigned char opCode = getChar(pos);
+    if(opCode == OP_TABLESWITCH)
+        return 4 + 2*(unsigned char) getChar(pos + 1);
+    return pgm_read_byte(instructionLength + opCode);
+}
+
+// Is [pos, pos + length) inside VM memory?
+bool inVmMemory(const void* pos, unsigned int length)
+{
+    return (char*) pos >= mem && length <= VM_MEMORY_SIZE && (char*) pos - mem <= VM_MEMORY_SIZE - length;
+}
+
+// Built-in externs for block operations on VM memory. Ranges outside of mem are ignored:
+// copies and fills do nothing, compares return 0 as if the blocks were equal, and searches
+// return 0 as if nothing was found. A compare can't fail with a value of its own, since any
+// value says how a compares to b, so programs check their ranges when that matters
+
+long vmMemcpy(Object* self, void* args)
 {
-    // This is hardcoded and lame, but will use this for now
-    if(strcmp(name, "toggleLed") == 0)
-        return (void*) vmToggleLed;
-    else if(strcmp(name, "setLed") == 0)
-        return (void*) vmSetLed;
-    else if(strcmp(name, "setUartCallback") == 0)
-        return (void*) vmSetCallback;
-    else if(strcmp(name, "uartTransmit") == 0)
-        return (void*) vmTransmit;
+    // Overlapping ranges are fine, this is really a memmove
+    VmMemcpyArgs* a = args;
+    if(inVmMemory(a->dst, a->length) && inVmMemory(a->src, a->length))
+        memmove(a->dst, a->src, a->length);
     return 0;
-}    
+}
+
+long vmMemset(Object* self, void* args)
+{
+    VmMemsetArgs* a = args;
+    if(inVmMemory(a->dst, a->length))
+        memset(a->dst, a->c, a->length);
+    return 0;
+}
+
+long vmMemcmp(Object* self, void* args)
+{
+    VmMemcmpArgs* a = args;
+    if(inVmMemory(a->a, a->length) && inVmMemory(a->b, a->length))
+        return memcmp(a->a, a->b, a->length);
+    return 0;
+}
+
+long vmMemchr(Object* self, void* args)
+{
+    VmMemchrArgs* a = args;
+    if(inVmMemory(a->pos, a->length))
+        return (int) memchr(a->pos, a->c, a->length);
+    return 0;
+}
+
+// Built-in externs for pools of fixed-size blocks, which programs use for what they can't
+// size statically. A pool can only be carved out of memory no stack uses, and only if the
+// biggest stack still fits below it. Pools live until the next program is loaded
+
+// Is pool one that poolCreate returned?
+static VmPool* findVmPool(VmPool* pool)
+{
+    for(VmPool* p = vmPools; p; p = p->next)
+        if(p == pool)
+            return p;
+    return 0;
+}
+
+long vmPoolCreate(Object* self, void* args)
+{
+    VmPoolCreateArgs* a = args;
+    unsigned int blockSize = a->blockSize < sizeof(char*) ? sizeof(char*) : a->blockSize;
+    unsigned long size = sizeof(VmPool) + (unsigned long) blockSize*a->count;
+    
+    cli();
+    VmPool* pool = 0;
+    if(a->count && size <= (unsigned int) (vmPoolSection - (char*) freeSection) - vmDefaultStackSize)
+    {
+        pool = (VmPool*) (vmPoolSection - size);
+        for(int i = 0; i < VM_NTHREADS; i++)
+            if(vmThreads[i].bottom && vmThreads[i].stack > (char*) pool)
+                pool = 0;
+    }
+    if(pool)
+    {
+        vmPoolSection = (char*) pool;
+        pool->next = vmPools;
+        vmPools = pool;
+    }
+    sei();
+    if(!pool)
+        return 0;
+    
+    pool->blockSize = blockSize;
+    pool->count = a->count;
+    pool->used = pool->peak = 0;
+    pool->free = pool->blocks;
+    for(unsigned int i = 0; i < pool->count; i++)
+        setPtr(pool->blocks + i*blockSize, i + 1 < pool->count ? pool->blocks + (i + 1)*blockSize : 0);
+    return (int) pool;
+}
+
+long vmPoolAlloc(Object* self, void* args)
+{
+    VmPool* pool = findVmPool(((VmPoolArgs*) args)->pool);
+    if(!pool)
+        return 0;
+    cli();
+    char* block = pool->free;
+    if(block)
+    {
+        pool->free = getPtr(block);
+        if(++pool->used > pool->peak)
+            pool->peak = pool->used;
+    }
+    sei();
+    return (int) block;
+}
+
+long vmPoolFree(Object* self, void* args)
+{
+    // Blocks that aren't blocks of the pool are ignored, and so are blocks that are already
+    // free, which would otherwise be linked in twice and handed out twice. Finding those
+    // walks the free list, so a free costs up to one step per free block of the pool
+    VmPoolFreeArgs* a = args;
+    VmPool* pool = findVmPool(a->pool);
+    if(!pool || a->block < pool->blocks || a->block >= pool->blocks + pool->blockSize*pool->count
+       || (a->block - pool->blocks) % pool->blockSize)
+        return 0;
+    cli();
+    char* block = pool->free;
+    while(block && block != a->block)
+        block = getPtr(block);
+    if(pool->used && !block)
+    {
+        setPtr(a->block, pool->free);
+        pool->free = a->block;
+        pool->used--;
+    }
+    sei();
+    return 0;
+}
+
+// Blocks in use in the low word and the most ever in use in the high word, 0 for no pool
+long vmPoolUsage(Object* self, void* args)
+{
+    VmPool* pool = findVmPool(((VmPoolArgs*) args)->pool);
+    if(!pool)
+        return 0;
+    cli();
+    long usage = (unsigned long) pool->peak << 16 | pool->used;
+    sei();
+    return usage;
+}
+
+const PROGMEM VmExtern vmExterns[] =
+{
+    [VM_EXTERN_MEMCPY] = { vmMemcpy, 0, sizeof(VmMemcpyArgs), 0, 0 },
+    [VM_EXTERN_MEMSET] = { vmMemset, 0, sizeof(VmMemsetArgs), 0, 0 },
+    [VM_EXTERN_MEMCMP] = { vmMemcmp, 0, sizeof(VmMemcmpArgs), 2, 0 },
+    [VM_EXTERN_MEMCHR] = { vmMemchr, 0, sizeof(VmMemchrArgs), 2, 0 },
+    [VM_EXTERN_MACQ15] = { vmMacQ15, 0, sizeof(DspMacArgs), 4, 0 },
+    [VM_EXTERN_MACQ7] = { vmMacQ7, 0, sizeof(DspMacArgs), 4, 0 },
+    [VM_EXTERN_FIRQ15] = { vmFirQ15, 0, sizeof(DspFirArgs), 2, 0 },
+    [VM_EXTERN_SUM] = { vmSum, 0, sizeof(DspArrayArgs), 4, 0 },
+    [VM_EXTERN_MIN] = { vmMin, 0, sizeof(DspArrayArgs), 2, 0 },
+    [VM_EXTERN_MAX] = { vmMax, 0, sizeof(DspArrayArgs), 2, 0 },
+    [VM_EXTERN_MEAN] = { vmMean, 0, sizeof(DspArrayArgs), 2, 0 },
+    [VM_EXTERN_SCALE] = { vmScale, 0, sizeof(DspScaleArgs), 0, 0 },
+    // Setting and toggling the led are single writes (sbi, cbi, out to PINB), no lock needed
+    [VM_EXTERN_TOGGLELED] = { vmToggleLed, (Object*) &led, 0, 0, 0 },
+    [VM_EXTERN_SETLED] = { vmSetLed, (Object*) &led, sizeof(char), 0, 0 },
+    // The uart is shared with its interrupt handlers
+    [VM_EXTERN_SETUARTCALLBACK] = { vmSetCallback, (Object*) &uart, sizeof(SetCallbackArgs), 0, VM_EXTERN_LOCKED },
+    [VM_EXTERN_UARTTRANSMIT] = { vmTransmit, (Object*) &uart, sizeof(TransmitArgs), 0, VM_EXTERN_LOCKED },
+    [VM_EXTERN_POOLCREATE] = { vmPoolCreate, 0, sizeof(VmPoolCreateArgs), 2, 0 },
+    [VM_EXTERN_POOLALLOC] = { vmPoolAlloc, 0, sizeof(VmPoolArgs), 2, 0 },
+    [VM_EXTERN_POOLFREE] = { vmPoolFree, 0, sizeof(VmPoolFreeArgs), 0, 0 },
+    [VM_EXTERN_POOLUSAGE] = { vmPoolUsage, 0, sizeof(VmPoolArgs), 4, 0 }
+};
+
+const PROGMEM VmExternEntry vmExternRegistry[VM_NEXTERNS] =
+{
+    { 0xA45CEC64UL, VM_EXTERN_MEMCPY, &vmExterns[VM_EXTERN_MEMCPY] }, // memcpy
+    { 0xCB80CC06UL, VM_EXTERN_MEMSET, &vmExterns[VM_EXTERN_MEMSET] }, // memset
+    { 0xAF3CAA0AUL, VM_EXTERN_MEMCMP, &vmExterns[VM_EXTERN_MEMCMP] }, // memcmp
+    { 0xAF4975FDUL, VM_EXTERN_MEMCHR, &vmExterns[VM_EXTERN_MEMCHR] }, // memchr
+    { 0x291F2C11UL, VM_EXTERN_MACQ15, &vmExterns[VM_EXTERN_MACQ15] }, // macQ15
+    { 0x8EF035A4UL, VM_EXTERN_MACQ7, &vmExterns[VM_EXTERN_MACQ7] }, // macQ7
+    { 0x64783A3BUL, VM_EXTERN_FIRQ15, &vmExterns[VM_EXTERN_FIRQ15] }, // firQ15
+    { 0xDD4E3AA8UL, VM_EXTERN_SUM, &vmExterns[VM_EXTERN_SUM] }, // sum
+    { 0xC98F4557UL, VM_EXTERN_MIN, &vmExterns[VM_EXTERN_MIN] }, // min
+    { 0xD7A2E319UL, VM_EXTERN_MAX, &vmExterns[VM_EXTERN_MAX] }, // max
+    { 0x9EDE2954UL, VM_EXTERN_MEAN, &vmExterns[VM_EXTERN_MEAN] }, // mean
+    { 0x82971C71UL, VM_EXTERN_SCALE, &vmExterns[VM_EXTERN_SCALE] }, // scale
+    { 0x4C88FBAAUL, VM_EXTERN_TOGGLELED, &vmExterns[VM_EXTERN_TOGGLELED] }, // toggleLed
+    { 0xB029E8A4UL, VM_EXTERN_SETLED, &vmExterns[VM_EXTERN_SETLED] }, // setLed
+    { 0x68EF8228UL, VM_EXTERN_SETUARTCALLBACK, &vmExterns[VM_EXTERN_SETUARTCALLBACK] }, // setUartCallback
+    { 0x276C0999UL, VM_EXTERN_UARTTRANSMIT, &vmExterns[VM_EXTERN_UARTTRANSMIT] }, // uartTransmit
+    { 0x280358F3UL, VM_EXTERN_POOLCREATE, &vmExterns[VM_EXTERN_POOLCREATE] }, // poolCreate
+    { 0x6C1A9F48UL, VM_EXTERN_POOLALLOC, &vmExterns[VM_EXTERN_POOLALLOC] }, // poolAlloc
+    { 0xF8B41969UL, VM_EXTERN_POOLFREE, &vmExterns[VM_EXTERN_POOLFREE] }, // poolFree
+    { 0xB33CD162UL, VM_EXTERN_POOLUSAGE, &vmExterns[VM_EXTERN_POOLUSAGE] } // poolUsage
+};
+
+// FNV-1a, which the registry knows the extern names by
+unsigned long hashName(const char* name)
+{
+    unsigned long hash = 2166136261UL;
+    while(*name)
+        hash = (hash ^ (unsigned char) *name++) * 16777619UL;
+    return hash;
+}
+
+const VmExtern* findExternById(unsigned int id)
+{
+    for(int i = 0; i < VM_NEXTERNS; i++)
+        if(pgm_read_word(&vmExternRegistry[i].id) == id)
+            return (const VmExtern*) pgm_read_word(&vmExternRegistry[i].ext);
+    return 0;
+}
+
+const VmExtern* findExternByName(const char* name)
+{
+    unsigned long hash = hashName(name);
+    for(int i = 0; i < VM_NEXTERNS; i++)
+        if(pgm_read_dword(&vmExternRegistry[i].hash) == hash)
+            return (const VmExtern*) pgm_read_word(&vmExternRegistry[i].ext);
+    return 0;
+}
+
+typedef struct
+{
+    VmExternFn fn;
+    void* args;
+    long result;
+} VmExternCall;
+
+// Runs a locked extern on behalf of SYNC
+int lockedVmExtern(Object* self, int arg)
+{
+    VmExternCall* call = (VmExternCall*) arg;
+    call->result = call->fn(self, call->args);
+    return 0;
+}
+
+// Calls the extern with its arguments on top of the stack and replaces them with its
+// return value. Locked externs are called right away if we can take the lock without
+// blocking, or already hold it
+void callVmExtern(VmThread* thread, const VmExtern* ext)
+{
+    VmExternCall call = { (VmExternFn) pgm_read_word(&ext->fn), thread->sp, 0 };
+    Object* self = (Object*) pgm_read_word(&ext->obj);
+    int locked = 0;
+    if(pgm_read_byte(&ext->flags) & VM_EXTERN_LOCKED)
+        locked = LOCK(self);
+    if(locked >= 0)
+    {
+        call.result = call.fn(self, call.args);
+        if(locked)
+            UNLOCK(self);
+    }
+    else
+        SYNC(self, lockedVmExtern, &call);
+
+    thread->sp += pgm_read_byte(&ext->argSize);
+    switch(pgm_read_byte(&ext->retSize))
+    {
+    case 1: pushChar(thread, call.result); break;
+    case 2: pushInt(thread, call.result); break;
+    case 4: pushLong(thread, call.result); break;
+    }
+}
 
 void linkProgram()
 {
@@ -305,99 +996,844 @@ void linkProgram()
         case OP_PUSHDWORDADDR:
         case OP_POPBYTEADDR:
         case OP_POPWORDADDR:
-        case OP_POPDWORDADDR: ;
+        case OP_POPDWORDADDR:
+        case OP_PUSHBYTEADDRIDX:
+        case OP_PUSHWORDADDRIDX:
+        case OP_PUSHDWORDADDRIDX:
+        case OP_POPBYTEADDRIDX:
+        case OP_POPWORDADDRIDX:
+        case OP_POPDWORDADDRIDX: ;
         case OP_JMP:
         case OP_JNEZ:
-        case OP_JEZ: ;
+        case OP_JEZ:
+        case OP_JLTBYTE:
+        case OP_JLTWORD:
+        case OP_JLTDWORD:
+        case OP_JGEBYTE:
+        case OP_JGEWORD:
+        case OP_JGEDWORD:
+        case OP_JEQBYTE:
+        case OP_JEQWORD:
+        case OP_JEQDWORD:
+        case OP_JNEBYTE:
+        case OP_JNEWORD:
+        case OP_JNEDWORD:
+        case OP_JLTUBYTE:
+        case OP_JLTUWORD:
+        case OP_JLTUDWORD:
+        case OP_JGEUBYTE:
+        case OP_JGEUWORD:
+        case OP_JGEUDWORD:
+        case OP_TAILCALL: ;
             int addr = getInt(pos + 1);
             setPtr(pos + 1, mem + addr);
             break;
             
-        case OP_CALL:
-        case OP_CALLE: ;
+        case OP_CALL: ;
             addr = getInt(pos + 1);
             if(mem + addr < (char*) externSection)
                 setPtr(pos + 1, mem + addr);
             else
             {
+                // A call to a name in the extern section
                 setChar(pos, OP_CALLE);
-                setPtr(pos + 1, getAddrFromName(mem + addr));
+                setPtr(pos + 1, (void*) findExternByName(mem + addr));
             }
             break;
+
+        case OP_CALLE:
+            // A call to an extern by its ID, which needs no extern section at all
+            setPtr(pos + 1, (void*) findExternById(getInt(pos + 1)));
+            break;
+
+        case OP_TABLESWITCH: ;
+            // The default target and every entry of the table
+            for(char* entry = pos + 2; entry < (char*) pos + instructionSize(pos); entry += 2)
+                setPtr(entry, mem + getInt(entry));
+            break;
+
+        case OP_IN:
+        case OP_OUT:
+        case OP_SBI:
+        case OP_CBI: ;
+            // Keep the bits of the register the whitelist allows, or send it all to the
+            // dummy if none are left
+            unsigned char mask = 0;
+            for(int i = 0; i < sizeof(ioWhitelist)/sizeof(*ioWhitelist); i++)
+                if(pgm_read_word(&ioWhitelist[i].addr) == (unsigned int) getInt(pos + 1))
+                    mask = getChar(pos + 3) & (opCode == OP_IN ? pgm_read_byte(&ioWhitelist[i].readMask)
+                                                               : pgm_read_byte(&ioWhitelist[i].writeMask));
+            setPtr(pos + 1, mask ? (void*) getInt(pos + 1) : &ioDummy);
+            setChar(pos + 3, mask);
+            break;
+
+        case OP_DJNZWORDFP:
+            setPtr(pos + 3, mem + getInt(pos + 3));
+            break;
+
         default:
+            // This includes the short forms, whose jumps are relative and need no relocation
             break;
         }
-        pos += pgm_read_byte(instructionLength + opCode);
+        pos += instructionSize(pos);
     }
 }
 
-void initStacks()
+// Load-time verification of the linked program. It checks that every instruction is known
+// and whole, that jumps and calls land on instructions, and follows every path through
+// every method to find how deep the stack gets below its frame, callees included. What
+// comes out is the stack size of every root (entry point or method whose address is
+// taken), which popVmThread() allocates a stack of exactly when a message starts one, so
+// nothing has to check for overflows at run time. Some patterns the stack use depends on
+// are required:
+// - a method pops the same number of bytes at every RET, and every path to an instruction
+//   has the same stack depth there
+// - SYNC is preceded by a PUSHADDR of the method, with only the object pushed after it
+// - ASYNC is directly preceded by the PUSHBYTEIMM of its argument size
+// Recursion makes the depth unbounded, in which case every stack gets an even share of
+// memory as before. The verifier works in the memory after the extern section, which the
+// stacks don't use yet: two bits per byte of code marking where instructions start and
+// which of them are targets (of jumps, or methods), then the methods, then the stack depth
+// at every target, and the calls between methods from the end of memory downwards. Only
+// targets need a depth kept, every other instruction is reached from the one before it.
+// Programs whose code, scratch memory and tables don't fit in VM_MEMORY_SIZE are rejected
+
+#define VERIFY_DEPTH 0x7FFF   // The depth bits of a target
+#define VERIFY_UNSEEN 0x7FFF  // Depth of a target not reached yet
+#define VERIFY_PENDING 0x8000 // Reached but not followed yet
+
+#define VERIFY_NORETURN 0xFFFF // Argument size of a method without a RET
+
+typedef struct
 {
-    int totStackSize = (VM_MEMORY_SIZE - ((int) externSection - (int) mem));
-    int stackSize = totStackSize/VM_NTHREADS;
-    
-    vmThreads->bottom = externSection;
-    vmThreads->fp = vmThreads->sp = vmThreads->stack = vmThreads->bottom + stackSize + totStackSize % VM_NTHREADS;
+    char* addr;
+    unsigned int args;  // Bytes of arguments its RET pops
+    long depth;         // Deepest the stack gets below its frame, long since recursion grows it
+    bool root;          // Entry point or address taken, so that it can start a thread
+} VerifiedMethod;
+
+typedef struct
+{
+    char* addr;
+    unsigned int depth; // Stack depth, with VERIFY_PENDING
+} VerifiedTarget;
+
+typedef struct
+{
+    unsigned char caller;
+    unsigned char callee;
+    int offset; // Where the frame of the callee starts, relative to the frame of the caller
+} VerifiedCall;
 
-    VmThread* lastThread = vmThreads;
-    for(VmThread* thread = vmThreads->next; thread; thread = thread->next)
+unsigned char* verifyStarts;  // Bit per byte of code, set where an instruction starts
+unsigned char* verifyTargets; // Bit per byte of code, set where a target starts
+VerifiedMethod* verifyMethods;
+unsigned char nVerifyMethods;
+VerifiedTarget* verifyDepths; // By address, after the methods once they are all found
+int nVerifyDepths;
+VerifiedCall* verifyCalls; // From the end of memory, verifyCalls[-1] being the first
+int nVerifyCalls;
+
+static inline bool verifyBit(unsigned char* map, void* pos)
+{
+    unsigned int i = (char*) pos - (char*) programSection;
+    return map[i >> 3] & (1 << (i & 7));
+}
+
+static inline void setVerifyBit(unsigned char* map, void* pos)
+{
+    unsigned int i = (char*) pos - (char*) programSection;
+    map[i >> 3] |= 1 << (i & 7);
+}
+
+static bool verifyRoom()
+{
+    char* end = verifyDepths ? (char*) (verifyDepths + nVerifyDepths) : (char*) (verifyMethods + nVerifyMethods);
+    return end <= (char*) (verifyCalls - nVerifyCalls);
+}
+
+// Is pos the start of an instruction of the program?
+static bool isInstruction(void* pos)
+{
+    return (char*) pos >= (char*) programSection && (char*) pos < (char*) externSection
+                                                 && verifyBit(verifyStarts, pos);
+}
+
+// The depth entry of a target, by binary search
+static VerifiedTarget* findVerifiedTarget(void* addr)
+{
+    int low = 0, high = nVerifyDepths;
+    while(low < high)
     {
-        thread->bottom = lastThread->stack;
-        thread->fp = thread->sp = thread->stack = thread->bottom + stackSize;
-        lastThread = thread;
+        int mid = (low + high)/2;
+        if(verifyDepths[mid].addr < (char*) addr)
+            low = mid + 1;
+        else
+            high = mid;
     }
-    
-    for(VmThread* thread = vmThreads; thread; thread = thread->next)
-        memset(thread->bottom, 0, thread->stack - thread->bottom);
-}           
+    return verifyDepths + low;
+}
 
-void loadProgramSegment(int totalLength, int seq, int segmentLength, void* buffer)
+static int findVerifiedMethod(void* addr)
 {
-    // if currentlyLoading is 0:
-    // TODO: halt currently executing vm (loop through activeStack, check for thread->msg->meth == exec
-    // loop through active msgs, check if meth == exec, abort those who are
-    
-    // clear all I/O callback functions as well
-    currentlyLoading = true;
-    
-    for(int i = 0; i < segmentLength; i++)
-        mem[seq++] = ((char*) buffer)[i];
-    
-    if(seq == totalLength)
+    for(int i = 0; i < nVerifyMethods; i++)
+        if(verifyMethods[i].addr == addr)
+            return i;
+    return -1;
+}
+
+static bool addVerifiedMethod(void* addr, bool root)
+{
+    if(!isInstruction(addr))
+        return false;
+    int i = findVerifiedMethod(addr);
+    if(i >= 0)
     {
-        // Extract the header information and shift the code backwards
-        entryObject = mem + getInt(mem);
-        programSection = mem + getInt(mem + 2);
-        entryPoint = mem + getInt(mem + 4);
-        externSection = mem + getInt(mem + 6);
-        for(int i = 0; i < totalLength - 8; i++)
-            mem[i] = mem[i + 8];
-        
-        linkProgram();
-        initStacks();
+        verifyMethods[i].root |= root;
+        return true;
+    }
+    if(nVerifyMethods == 0xFF)
+        return false;
+    VerifiedMethod* method = verifyMethods + nVerifyMethods++;
+    if(!verifyRoom())
+        return false;
+    method->addr = addr;
+    method->root = root;
+    method->depth = 0;
+    return true;
+}
 
-        VmArgBin* bin = popVmArgBin();
-        bin->methodAddr = entryPoint;
-        bin->returnAddr = 0;
-        bin->argSize = 0;
-        bin->thread = popVmThread();
-        ASYNC(entryObject, exec, bin);
+// The jump target of an instruction, 0 if it doesn't jump
+static char* jumpTarget(char* pos)
+{
+    unsigned char opCode = getChar(pos);
+    switch(opCode)
+    {
+    case OP_JMP:
+    case OP_JEZ:
+    case OP_JNEZ:
+    case OP_JLTBYTE ... OP_JGEUDWORD:
+        return getPtr(pos + 1);
+    case OP_JMPS:
+    case OP_JEZS:
+    case OP_JNEZS:
+        return pos + 2 + getChar(pos + 1);
+    case OP_DJNZWORDFP:
+        return getPtr(pos + 3);
     }
+    return 0;
 }
 
-bool executeInstruction(VmThread* thread, VmArgBin* argBin)
+// How many bytes an instruction pops and then pushes, for all but the ones verifyMethod()
+// handles itself. Most come in byte, word and dword triples
+static bool stackUse(char* pos, unsigned int* pops, unsigned int* pushes)
 {
-    void* addr;
-    switch(getChar(thread->pc))
+    unsigned char opCode = getChar(pos);
+    *pops = *pushes = 0;
+    switch(opCode)
     {
-    case OP_PUSHFP: // push $fp+c
-        pushPtr(thread, thread->fp + getInt(thread->pc + 1));
-        thread->pc += 3;
+    case OP_PUSHFP:
+    case OP_PUSHADDR:
+    case OP_PUSHFPS:
+    case OP_PUSHWORDLOC0 ... OP_PUSHWORDLOC3:
+    case OP_PUSHWORDARG0:
+    case OP_PUSHWORDARG1:
+    case OP_PUSHWORDIMMS:
+        *pushes = 2;
         break;
-        
-    case OP_PUSHIMM: // push imm (reduce $sp with immediate)
-        thread->sp -= getInt(thread->pc + 1);
-        thread->pc += 3;
+    case OP_PUSHIMM:
+        *pushes = getInt(pos + 1);
+        break;
+    case OP_PUSHIMMS:
+        *pushes = (unsigned char) getChar(pos + 1);
+        break;
+    case OP_POPIMM:
+        *pops = getInt(pos + 1);
+        break;
+    case OP_POPIMMS:
+        *pops = (unsigned char) getChar(pos + 1);
+        break;
+    case OP_PUSHBYTEFP ... OP_PUSHDWORDFP:
+        *pushes = 1 << (opCode - OP_PUSHBYTEFP);
+        break;
+    case OP_PUSHBYTEADDR ... OP_PUSHDWORDADDR:
+        *pushes = 1 << (opCode - OP_PUSHBYTEADDR);
+        break;
+    case OP_PUSHBYTEIMM ... OP_PUSHDWORDIMM:
+        *pushes = 1 << (opCode - OP_PUSHBYTEIMM);
+        break;
+    case OP_PUSHBYTEFPS ... OP_PUSHDWORDFPS:
+        *pushes = 1 << (opCode - OP_PUSHBYTEFPS);
+        break;
+    case OP_PUSHDWORDIMMS:
+    case OP_PUSH2WORDFP:
+        *pushes = 4;
+        break;
+    case OP_PUSHBYTE ... OP_PUSHDWORD:
+        *pops = 2;
+        *pushes = 1 << (opCode - OP_PUSHBYTE);
+        break;
+    case OP_POPBYTEFP ... OP_POPDWORDFP:
+        *pops = 1 << (opCode - OP_POPBYTEFP);
+        break;
+    case OP_POPBYTEADDR ... OP_POPDWORDADDR:
+        *pops = 1 << (opCode - OP_POPBYTEADDR);
+        break;
+    case OP_POPBYTEFPS ... OP_POPDWORDFPS:
+        *pops = 1 << (opCode - OP_POPBYTEFPS);
+        break;
+    case OP_POPWORDLOC0 ... OP_POPWORDLOC3:
+        *pops = 2;
+        break;
+    case OP_POPBYTE ... OP_POPDWORD:
+        *pops = 2 + (1 << (opCode - OP_POPBYTE));
+        break;
+    case OP_ADDBYTE ... OP_XORDWORD:
+        *pushes = 1 << ((opCode - OP_ADDBYTE) % 3);
+        *pops = 2**pushes;
+        break;
+    case OP_SGZBYTE ... OP_SNEZDWORD:
+        *pops = 1 << ((opCode - OP_SGZBYTE) % 3);
+        *pushes = 1;
+        break;
+    case OP_JMP:
+    case OP_JMPS:
+        break;
+    case OP_JEZ:
+    case OP_JNEZ:
+    case OP_JEZS:
+    case OP_JNEZS:
+        *pops = 1;
+        break;
+    case OP_SLLBYTE ... OP_SRAVDWORD:
+        // Every other triple takes its count from the stack
+        *pushes = 1 << ((opCode - OP_SLLBYTE) % 3);
+        *pops = *pushes + ((opCode - OP_SLLBYTE)/3) % 2;
+        break;
+    case OP_ADDWORDFPFP:
+    case OP_SUBWORDFPFP:
+    case OP_ADDWORDFPIMM:
+    case OP_MOVWORDFP:
+    case OP_MOVWORDIMMFP:
+        break;
+    case OP_SLTBYTE ... OP_SLEUDWORD:
+        *pops = 2 << ((opCode - OP_SLTBYTE) % 3);
+        *pushes = 1;
+        break;
+    case OP_JLTBYTE ... OP_JGEUDWORD:
+        *pops = 2 << ((opCode - OP_JLTBYTE) % 3);
+        break;
+    case OP_ADDBYTEIMM ... OP_MULDWORDIMM:
+        // In place, but the top of the stack changes all the same
+        *pops = *pushes = 1 << ((opCode - OP_ADDBYTEIMM) % 3);
+        break;
+    case OP_INCBYTEFP ... OP_INCDWORDFP:
+        break;
+    case OP_PUSHBYTEADDRIDX ... OP_PUSHDWORDDISP:
+        *pops = 2;
+        *pushes = 1 << ((opCode - OP_PUSHBYTEADDRIDX) % 3);
+        break;
+    case OP_POPBYTEADDRIDX ... OP_POPDWORDDISP:
+        *pops = 2 + (1 << ((opCode - OP_POPBYTEADDRIDX) % 3));
+        break;
+    case OP_IN:
+        *pushes = 1;
+        break;
+    case OP_OUT:
+        *pops = 1;
+        break;
+    case OP_SBI:
+    case OP_CBI:
+    case OP_DJNZWORDFP:
+    case OP_HOT:
+        break;
+    case OP_SLEEP:
+    case OP_NOTIFY:
+        *pops = 2;
+        break;
+    case OP_AWAIT:
+        *pops = 2;
+        *pushes = 1;
+        break;
+    case OP_CHSEND:
+        *pops = 2 + (unsigned char) getChar(pos + 1);
+        *pushes = 1;
+        break;
+    case OP_CHRECV:
+        *pops = 2;
+        *pushes = 1 + (unsigned char) getChar(pos + 1);
+        break;
+    case OP_FPOLL:
+    case OP_FAWAIT:
+        *pops = 2;
+        *pushes = 1;
+        break;
+    default:
+        return false;
+    }
+    return true;
+}
+
+// Continues a path at target with the given depth, which must agree with any earlier path
+static bool reachInstruction(void* target, unsigned int depth)
+{
+    if(!isInstruction(target) || !verifyBit(verifyTargets, target) || depth >= VERIFY_UNSEEN)
+        return false;
+    VerifiedTarget* entry = findVerifiedTarget(target);
+    if((entry->depth & VERIFY_DEPTH) == VERIFY_UNSEEN)
+        entry->depth = VERIFY_PENDING | depth;
+    return (entry->depth & VERIFY_DEPTH) == depth;
+}
+
+static bool addVerifiedCall(unsigned char caller, unsigned char callee, int offset)
+{
+    VerifiedCall* call = verifyCalls - ++nVerifyCalls;
+    call->caller = caller;
+    call->callee = callee;
+    call->offset = offset;
+    return verifyRoom();
+}
+
+// Follows every path through a method, leaving the deepest the stack gets in its depth
+// and the calls it makes in verifyCalls
+static bool verifyMethod(unsigned char index)
+{
+    VerifiedMethod* method = verifyMethods + index;
+    for(int i = 0; i < nVerifyDepths; i++)
+        verifyDepths[i].depth = VERIFY_UNSEEN;
+    reachInstruction(method->addr, 0);
+
+    char* pos = 0;
+    char* prev = 0;       // Instruction before pos on the current path
+    char* syncMethod = 0; // Method last pushed by a PUSHADDR, for a SYNC
+    unsigned int syncDepth = 0;
+    unsigned int depth = 0;
+    for(;;)
+    {
+        if(!pos)
+        {
+            // Continue at a target, other paths lead there so forget what we knew about the stack
+            prev = syncMethod = 0;
+            VerifiedTarget* pending = verifyDepths;
+            while(pending < verifyDepths + nVerifyDepths && !(pending->depth & VERIFY_PENDING))
+                pending++;
+            if(pending == verifyDepths + nVerifyDepths)
+                return true;
+            pending->depth &= ~VERIFY_PENDING;
+            pos = pending->addr;
+            depth = pending->depth;
+        }
+        unsigned int pops = 0, pushes = 0;
+        bool next = true;
+        int callee;
+        unsigned char opCode = getChar(pos);
+        switch(opCode)
+        {
+        case OP_CALL:
+        case OP_SYNC:
+            if(opCode == OP_CALL)
+                callee = findVerifiedMethod(getPtr(pos + 1));
+            else if(syncMethod && syncDepth == depth - 2)
+                callee = findVerifiedMethod(syncMethod);
+            else
+                return false;
+            // The frame of a SYNC takes the place of the object and method
+            if(!addVerifiedCall(index, callee, opCode == OP_CALL ? depth + 4 : depth))
+                return false;
+            if(verifyMethods[callee].args == VERIFY_NORETURN)
+                next = false;
+            else
+                pops = verifyMethods[callee].args + (opCode == OP_SYNC ? 4 : 0);
+            break;
+
+        case OP_ASYNC:
+        case OP_ASYNCF:
+            // Argument size, baseline, deadline, object, method, future and arguments
+            if(!prev || getChar(prev) != OP_PUSHBYTEIMM)
+                return false;
+            pops = (opCode == OP_ASYNCF ? 15 : 13) + (unsigned char) getChar(prev + 1);
+            break;
+
+        case OP_CALLE: ;
+            const VmExtern* ext = getPtr(pos + 1);
+            pops = pgm_read_byte(&ext->argSize);
+            pushes = pgm_read_byte(&ext->retSize);
+            break;
+
+        case OP_RET:
+            if((unsigned int) getInt(pos + 1) != method->args)
+                return false;
+            next = false;
+            break;
+
+        case OP_TAILCALL: ;
+            callee = findVerifiedMethod(getPtr(pos + 1));
+            unsigned char newSize = getChar(pos + 3), oldSize = getChar(pos + 4);
+            if(oldSize != method->args || (newSize != verifyMethods[callee].args
+                                           && verifyMethods[callee].args != VERIFY_NORETURN))
+                return false;
+            // The new arguments are moved up to where the old ones are
+            if(!addVerifiedCall(index, callee, newSize - oldSize))
+                return false;
+            pops = newSize;
+            next = false;
+            break;
+
+        case OP_TABLESWITCH:
+            pops = 2;
+            if(depth < pops)
+                return false;
+            for(char* entry = pos + 2; entry < pos + instructionSize(pos); entry += 2)
+                if(!reachInstruction(getPtr(entry), depth - pops))
+                    return false;
+            next = false;
+            break;
+
+        default:
+            if(!stackUse(pos, &pops, &pushes))
+                return false;
+            break;
+        }
+
+        if(pops > depth)
+            return false;
+        // The method pushed for a SYNC is known until something reaches down to it
+        if(depth - pops < syncDepth)
+            syncMethod = 0;
+        depth = depth - pops + pushes;
+        if(depth > VM_MEMORY_SIZE)
+            return false;
+        if((long) depth > method->depth)
+            method->depth = depth;
+        if(opCode == OP_PUSHADDR && isInstruction(getPtr(pos + 1)))
+        {
+            syncMethod = getPtr(pos + 1);
+            syncDepth = depth;
+        }
+
+        char* target = jumpTarget(pos);
+        if(target && !reachInstruction(target, depth))
+            return false;
+        if(opCode == OP_JMP || opCode == OP_JMPS)
+            next = false;
+
+        prev = pos;
+        if(next)
+        {
+            pos += instructionSize(pos);
+            if(!isInstruction(pos))
+                return false;
+            // A target is followed from the list of targets, with the depth all paths agree on
+            if(verifyBit(verifyTargets, pos))
+            {
+                if(!reachInstruction(pos, depth))
+                    return false;
+                pos = 0;
+            }
+        }
+        else
+            pos = 0;
+    }
+}
+
+// Checks the linked program and leaves the stack sizes of its roots in vmStackHints,
+// followed by freeSection. Returns false if it can't be run
+bool verifyProgram()
+{
+    unsigned int mapSize = ((char*) externSection - (char*) programSection + 7)/8;
+    verifyStarts = externSection;
+    verifyTargets = verifyStarts + mapSize;
+    verifyMethods = (VerifiedMethod*) (verifyTargets + mapSize);
+    verifyDepths = 0;
+    verifyCalls = (VerifiedCall*) (mem + VM_MEMORY_SIZE);
+    nVerifyMethods = nVerifyDepths = nVerifyCalls = 0;
+    if(!verifyRoom())
+        return false;
+
+    // Find the instructions
+    memset(verifyStarts, 0, 2*mapSize);
+    for(char* pos = programSection; pos < (char*) externSection; pos += instructionSize(pos))
+    {
+        unsigned char opCode = getChar(pos);
+        if(!instructionSize(pos) || opCode == OP_NATIVE || (char*) externSection - pos < instructionSize(pos))
+            return false;
+        setVerifyBit(verifyStarts, pos);
+    }
+
+    // Check the operands and find the methods
+    if(!addVerifiedMethod(entryPoint, true))
+        return false;
+    for(char* pos = programSection; pos < (char*) externSection; pos += instructionSize(pos))
+    {
+        unsigned char opCode = getChar(pos);
+        char* target = jumpTarget(pos);
+        if(target)
+        {
+            if(!isInstruction(target))
+                return false;
+            setVerifyBit(verifyTargets, target);
+        }
+        switch(opCode)
+        {
+        case OP_PUSHADDR:
+            // Code addresses are methods to SYNC, ASYNC or hand to an extern
+            if(isInstruction(getPtr(pos + 1)) && !addVerifiedMethod(getPtr(pos + 1), true))
+                return false;
+            break;
+
+        case OP_PUSHBYTEADDR ... OP_PUSHDWORDADDR:
+            if(!inVmMemory(getPtr(pos + 1), 1 << (opCode - OP_PUSHBYTEADDR)))
+                return false;
+            break;
+
+        case OP_POPBYTEADDR ... OP_POPDWORDADDR:
+            if(!inVmMemory(getPtr(pos + 1), 1 << (opCode - OP_POPBYTEADDR)))
+                return false;
+            break;
+
+        case OP_CALL:
+        case OP_TAILCALL:
+            if(!addVerifiedMethod(getPtr(pos + 1), false))
+                return false;
+            break;
+
+        case OP_CALLE:
+            // An extern the firmware doesn't have
+            if(!getPtr(pos + 1))
+                return false;
+            break;
+
+        case OP_TABLESWITCH:
+            for(char* entry = pos + 2; entry < pos + instructionSize(pos); entry += 2)
+            {
+                if(!isInstruction(getPtr(entry)))
+                    return false;
+                setVerifyBit(verifyTargets, getPtr(entry));
+            }
+            break;
+        }
+    }
+
+    // Paths start at methods, and the depths of the targets go after the methods in
+    // address order
+    for(VerifiedMethod* method = verifyMethods; method < verifyMethods + nVerifyMethods; method++)
+        setVerifyBit(verifyTargets, method->addr);
+    verifyDepths = (VerifiedTarget*) (verifyMethods + nVerifyMethods);
+    for(char* pos = programSection; pos < (char*) externSection; pos += instructionSize(pos))
+    {
+        if(!verifyBit(verifyTargets, pos))
+            continue;
+        nVerifyDepths++;
+        if(!verifyRoom())
+            return false;
+        verifyDepths[nVerifyDepths - 1].addr = pos;
+    }
+
+    // The arguments of a method are what its first RET pops
+    for(VerifiedMethod* method = verifyMethods; method < verifyMethods + nVerifyMethods; method++)
+    {
+        method->args = VERIFY_NORETURN;
+        for(char* pos = method->addr; pos < (char*) externSection; pos += instructionSize(pos))
+        {
+            if(getChar(pos) == OP_RET)
+            {
+                method->args = getInt(pos + 1);
+                break;
+            }
+            if((unsigned char) getChar(pos) == OP_TAILCALL)
+            {
+                method->args = (unsigned char) getChar(pos + 4);
+                break;
+            }
+        }
+    }
+
+    for(int i = 0; i < nVerifyMethods; i++)
+        if(!verifyMethod(i))
+            return false;
+
+    // Add the depth of the callees until nothing changes, which takes at most as many
+    // rounds as there are methods unless there is recursion
+    bool bounded = true;
+    for(int round = 0; bounded; round++)
+    {
+        bool changed = false;
+        for(VerifiedCall* call = verifyCalls - nVerifyCalls; call < verifyCalls; call++)
+        {
+            long depth = call->offset + verifyMethods[call->callee].depth;
+            if(depth > verifyMethods[call->caller].depth)
+            {
+                verifyMethods[call->caller].depth = depth;
+                changed = true;
+            }
+        }
+        if(!changed)
+            break;
+        bounded = round <= nVerifyMethods;
+    }
+
+    // A thread starts a root with its arguments and the header of its frame on the stack.
+    // The hints go where the verifier's map was, below the methods they are copied from
+    vmStackHints = externSection;
+    nVmStackHints = 0;
+    vmDefaultStackSize = 0;
+    for(VerifiedMethod* method = verifyMethods; bounded && method < verifyMethods + nVerifyMethods; method++)
+    {
+        if(!method->root)
+            continue;
+        unsigned int args = method->args == VERIFY_NORETURN ? 0 : method->args;
+        long stackSize = args + 4 + method->depth;
+        if(stackSize > VM_MEMORY_SIZE)
+            return false;
+        char* addr = method->addr;
+        vmStackHints[nVmStackHints].method = addr;
+        vmStackHints[nVmStackHints++].size = stackSize;
+        if(stackSize > vmDefaultStackSize)
+            vmDefaultStackSize = stackSize;
+    }
+    freeSection = vmStackHints + nVmStackHints;
+    
+    unsigned int freeSize = mem + VM_MEMORY_SIZE - (char*) freeSection;
+    if(!bounded)
+        vmDefaultStackSize = freeSize/VM_NSHARES;
+    return vmDefaultStackSize <= freeSize;
+}
+
+bool matchesRule(char* pos, const FusionRule* rule)
+{
+    for(int i = 0; i < sizeof(rule->ops) && pgm_read_byte(&rule->ops[i]); i++)
+    {
+        unsigned char opCode = pgm_read_byte(&rule->ops[i]);
+        if(pos >= (char*) externSection || (unsigned char) getChar(pos) != opCode)
+            return false;
+        pos += instructionSize(pos);
+    }
+    return true;
+}
+
+// Peephole pass over the linked code. A superinstruction only overwrites the first opcode
+// of its sequence and reads its operands from where they already are, the rest of the
+// sequence stays untouched so that jumps into the middle of it still work
+void fuseInstructions()
+{
+    char* pos = programSection;
+    while(pos < (char*) externSection)
+    {
+        for(int i = 0; i < sizeof(fusionRules)/sizeof(*fusionRules); i++)
+        {
+            if(matchesRule(pos, fusionRules + i))
+            {
+                setChar(pos, pgm_read_byte(&fusionRules[i].fused));
+                break;
+            }
+        }
+        pos += instructionSize(pos);
+    }
+}
+
+// Returns the stacks of all threads and the memory of all pools, and drops the messages
+// of the old program that waited for them
+void initStacks()
+{
+    for(int i = 0; i < VM_NTHREADS; i++)
+        vmThreads[i].bottom = vmThreads[i].stack = 0;
+    while(vmThreadWaiters)
+    {
+        VmArgBin* next = vmThreadWaiters->next;
+        freeVmArgBin(vmThreadWaiters);
+        vmThreadWaiters = next;
+    }
+    vmPoolSection = mem + VM_MEMORY_SIZE;
+    vmPools = 0;
+}           
+
+void loadProgramSegment(int totalLength, int seq, int segmentLength, void* buffer)
+{
+    // if currentlyLoading is 0:
+    // TODO: halt currently executing vm (loop through activeStack, check for thread->msg->meth == exec
+    // loop through active msgs, check if meth == exec, abort those who are
+    
+    // clear all I/O callback functions as well
+    currentlyLoading = true;
+    
+    for(int i = 0; i < segmentLength; i++)
+        mem[seq++] = ((char*) buffer)[i];
+    
+    if(seq == totalLength)
+    {
+        // Extract the header information and shift the code backwards
+        entryObject = mem + getInt(mem);
+        programSection = mem + getInt(mem + 2);
+        entryPoint = mem + getInt(mem + 4);
+        externSection = mem + getInt(mem + 6);
+        for(int i = 0; i < totalLength - 8; i++)
+            mem[i] = mem[i + 8];
+        
+        currentlyLoading = false;
+        linkProgram();
+        if(!verifyProgram())
+        {
+            // Malformed or too big or deep for our memory, don't run it
+            sendReject(&uart, VM_REJECT_VERIFY);
+            return;
+        }
+        fuseInstructions();
+        initStacks();
+
+        VmArgBin* bin = allocVmArgBin(0);
+        if(!bin)
+        {
+            sendReject(&uart, VM_REJECT_MESSAGE);
+            return;
+        }
+        bin->methodAddr = entryPoint;
+        bin->returnAddr = 0;
+        // No thread yet (allocVmArgBin() leaves it 0), exec() gets one with a stack and pushes
+        // the 0/0 frame header the final RET of the entry point returns through
+        ASYNC(entryObject, exec, bin);
+    }
+}
+
+// Turns the current frame into a frame for calling target with the newSize bytes of
+// arguments on top of the stack, the header of the frame moves along with them
+static inline void tailCall(VmThread* thread, char* target, unsigned char newSize, unsigned char oldSize)
+{
+    char* oldFp = getPtr(thread->fp);
+    char* retAddr = getPtr(thread->fp + 2);
+    char* fp = thread->fp + oldSize - newSize;
+    memmove(fp + 4, thread->sp, newSize);
+    setPtr(fp, oldFp);
+    setPtr(fp + 2, retAddr);
+    // A stackless SYNC into this frame follows it
+    if(thread->nLocks && thread->locks[thread->nLocks - 1].fp == thread->fp)
+        thread->locks[thread->nLocks - 1].fp = fp;
+    thread->fp = thread->sp = fp;
+    thread->pc = target;
+}
+
+// Read-modify-write of an I/O register, with interrupts off so that no handler touching
+// the same register gets in between
+static inline void ioModify(volatile char* reg, char clear, char set)
+{
+    char sreg = SREG;
+    cli();
+    *reg = (*reg & ~clear) | set;
+    SREG = sreg;
+}
+
+bool executeInstruction(VmThread* thread, VmArgBin* argBin)
+{
+    void* addr;
+    switch((unsigned char) getChar(thread->pc))
+    {
+    case OP_PUSHFP: // push $fp+c
+        pushPtr(thread, thread->fp + getInt(thread->pc + 1));
+        thread->pc += 3;
+        break;
+        
+    case OP_PUSHIMM: // push imm (reduce $sp with immediate)
+        thread->sp -= getInt(thread->pc + 1);
+        thread->pc += 3;
         break;
         
     case OP_PUSHADDR: // push label
@@ -544,6 +1980,8 @@ bool executeInstruction(VmThread* thread, VmArgBin* argBin)
         break;
         
     case OP_RET: ;
+        char* frame = thread->fp;
+        char* top = thread->sp;
         int spDec = getInt(thread->pc + 1);
         // $sp = $fp + arg + 4
         thread->sp = thread->fp + spDec + 4;
@@ -552,13 +1990,17 @@ bool executeInstruction(VmThread* thread, VmArgBin* argBin)
         thread->pc = retAddr;
         // $fp = [$fp]
         thread->fp = getPtr(thread->fp);
+        if(thread->nLocks && thread->locks[thread->nLocks - 1].fp == frame)
+            releaseVmLock(thread);
         // If $fp is 0, we reached the bottom of either a sync or async call
         if(thread->fp == 0)
         {
             if(retAddr == 0) // This was an async call, recycle the thread obj
             {
+                if(argBin->future)
+                    resolveVmFuture(argBin->future, getLong(top));
                 pushVmThread(thread);
-                pushVmArgBin(argBin);
+                freeVmArgBin(argBin);
             }                
             return false; // Stop executing instructions on this object
         }
@@ -567,6 +2009,25 @@ bool executeInstruction(VmThread* thread, VmArgBin* argBin)
     case OP_SYNC: ;
         void* obj = popPtr(thread);
         void* methodAddress = popPtr(thread);
+        // Unless someone else holds the object, we lock it ourselves (if we don't already
+        // hold it) and call the method like any other, remembering to unlock on its RET
+        int locked = thread->nLocks < VM_LOCKDEPTH ? LOCK(obj) : -1;
+        if(locked >= 0)
+        {
+            VmLock* lock = &thread->locks[thread->nLocks++];
+            lock->obj = locked ? obj : 0;
+            lock->prevObj = thread->obj;
+            thread->heldLocks += locked;
+            pushPtr(thread, thread->pc + 1);
+            pushPtr(thread, thread->fp);
+            thread->fp = thread->sp;
+            lock->fp = thread->fp;
+            thread->obj = obj;
+            thread->pc = methodAddress;
+            break;
+        }
+        // Otherwise sync has to block us until the object is free, with a new exec on the C
+        // stack to run the method
         // We can reuse the current thread in sync calls
         argBin->thread = thread;
         argBin->methodAddr = methodAddress;
@@ -578,38 +2039,46 @@ bool executeInstruction(VmThread* thread, VmArgBin* argBin)
         pushPtr(thread, 0);
         // But we still need to save and restore $fp, so we save it here ...
         void* oldFp = thread->fp;
+        Object* oldObj = thread->obj;
         thread->fp = thread->sp;
+        thread->syncDepth++;
         SYNC(obj, exec, argBin);
+        thread->syncDepth--;
         // ... and restore it after the call
         thread->fp = oldFp;
+        thread->obj = oldObj;
         break;
         
-    case OP_ASYNC: ;
-        char argSize = popChar(thread);
+    case OP_ASYNC:
+    case OP_ASYNCF: ;
+        unsigned char argSize = popChar(thread);
         long baseline = popLong(thread);
         long deadline = popLong(thread);
         obj = popPtr(thread);
         methodAddress = popPtr(thread);
-        VmArgBin* argBin = popVmArgBin();
-        argBin->argSize = argSize;
-        popArray(argBin->argStack, thread, argSize);
-        argBin->methodAddr = methodAddress;
-        argBin->returnAddr = 0;
-        SEND(USEC(baseline), USEC(deadline), obj, exec, argBin);
+        char* future = (unsigned char) getChar(thread->pc) == OP_ASYNCF ? popPtr(thread) : 0;
+        VmArgBin* newBin = allocVmArgBin(argSize);
+        if(future)
+        {
+            setInt(future + FUTURE_STATE, newBin ? FUTURE_PENDING : FUTURE_DROPPED);
+            setPtr(future + FUTURE_WAITER, 0);
+        }
+        if(newBin)
+        {
+            popArray(newBin->argStack, thread, argSize);
+            newBin->methodAddr = methodAddress;
+            newBin->returnAddr = 0;
+            newBin->future = future;
+            SEND(USEC(baseline), USEC(deadline), obj, exec, newBin);
+        }
+        else
+            thread->sp += argSize; // No room for the message, it's dropped
         thread->pc++;
         break;
         
-    case OP_CALLE: // call external (I/O) function
-        // First push a dummy return value and old $fp onto the stack just to
-        // present a stack frame consistent with the rest of the different call types
-        pushInt(thread, 0);
-        pushInt(thread, 0);
-        void* savedFp = thread->fp;
-        thread->fp = thread->sp;
-        void (*fun)(VmThread*) = getPtr(thread->pc + 1);
-        fun(thread);
-        thread->fp = savedFp;
-        thread->pc += 3;    
+    case OP_CALLE: // call external (native) function through its descriptor
+        callVmExtern(thread, getPtr(thread->pc + 1));
+        thread->pc += 3;
         break;
            
     case OP_ADDBYTE: ;
@@ -981,7 +2450,7 @@ bool executeInstruction(VmThread* thread, VmArgBin* argBin)
         ca = popChar(thread);
         cb = popChar(thread);
         ca = *((unsigned char*) &ca) >> cb;
-        pushChar(thread, cb);
+        pushChar(thread, ca);
         thread->pc += 1;
         break;
         
@@ -1026,7 +2495,7 @@ bool executeInstruction(VmThread* thread, VmArgBin* argBin)
         ca = popChar(thread);
         cb = popChar(thread);
         ca = ca >> cb;
-        pushChar(thread, cb);
+        pushChar(thread, ca);
         thread->pc += 1;
         break;
         
@@ -1045,31 +2514,2125 @@ bool executeInstruction(VmThread* thread, VmArgBin* argBin)
         pushLong(thread, la);
         thread->pc += 1;
         break;
-    }
-    return true;
-}
 
-void exec(Object* obj, int arg)
-{
-    VmArgBin* argBin = (VmArgBin*) arg;
-    VmThread* thread;
-    
-    // If a thread was provided, this is a sync call
-    if(argBin->thread)
-    {
-        thread = argBin->thread;
-        thread->pc = argBin->methodAddr;
-    }
-    else
-    {
-        // Fetch a new thread object and populate it with the stack contents
-        thread = popVmThread();
-        pushArray(thread, argBin->argStack, argBin->argSize);
-        pushInt(thread, 0); // fake return address
-        pushInt(thread, 0); // fake old frame pointer
-        thread->fp = thread->sp;
-        thread->pc = argBin->methodAddr;
-    }
-    
+    case OP_ADDWORDFPFP: // word [$fp+c] = [$fp+b] + [$fp+a]
+        ia = getInt(thread->fp + getInt(thread->pc + 4));
+        ib = getInt(thread->fp + getInt(thread->pc + 1));
+        setInt(thread->fp + getInt(thread->pc + 8), ia + ib);
+        thread->pc += 10;
+        break;
+
+    case OP_SUBWORDFPFP: // word [$fp+c] = [$fp+b] - [$fp+a]
+        ia = getInt(thread->fp + getInt(thread->pc + 4));
+        ib = getInt(thread->fp + getInt(thread->pc + 1));
+        setInt(thread->fp + getInt(thread->pc + 8), ia - ib);
+        thread->pc += 10;
+        break;
+
+    case OP_ADDWORDFPIMM: // word [$fp+c] = k + [$fp+a]
+        ia = getInt(thread->pc + 4);
+        ib = getInt(thread->fp + getInt(thread->pc + 1));
+        setInt(thread->fp + getInt(thread->pc + 8), ia + ib);
+        thread->pc += 10;
+        break;
+
+    case OP_PUSH2WORDFP: // push word [$fp+a], push word [$fp+b]
+        pushInt(thread, getInt(thread->fp + getInt(thread->pc + 1)));
+        pushInt(thread, getInt(thread->fp + getInt(thread->pc + 4)));
+        thread->pc += 6;
+        break;
+
+    case OP_MOVWORDFP: // word [$fp+c] = [$fp+a]
+        setInt(thread->fp + getInt(thread->pc + 4), getInt(thread->fp + getInt(thread->pc + 1)));
+        thread->pc += 6;
+        break;
+
+    case OP_MOVWORDIMMFP: // word [$fp+c] = k
+        setInt(thread->fp + getInt(thread->pc + 4), getInt(thread->pc + 1));
+        thread->pc += 6;
+        break;
+
+    case OP_SLTBYTE: // push byte [$sp] < [$sp+1]
+        ca = popChar(thread);
+        cb = popChar(thread);
+        pushChar(thread, ca < cb);
+        thread->pc += 1;
+        break;
+
+    case OP_SLTWORD: // push byte [$sp] < [$sp+2]
+        ia = popInt(thread);
+        ib = popInt(thread);
+        pushChar(thread, ia < ib);
+        thread->pc += 1;
+        break;
+
+    case OP_SLTDWORD: // push byte [$sp] < [$sp+4]
+        la = popLong(thread);
+        lb = popLong(thread);
+        pushChar(thread, la < lb);
+        thread->pc += 1;
+        break;
+
+    case OP_SLEBYTE: // push byte [$sp] <= [$sp+1]
+        ca = popChar(thread);
+        cb = popChar(thread);
+        pushChar(thread, ca <= cb);
+        thread->pc += 1;
+        break;
+
+    case OP_SLEWORD: // push byte [$sp] <= [$sp+2]
+        ia = popInt(thread);
+        ib = popInt(thread);
+        pushChar(thread, ia <= ib);
+        thread->pc += 1;
+        break;
+
+    case OP_SLEDWORD: // push byte [$sp] <= [$sp+4]
+        la = popLong(thread);
+        lb = popLong(thread);
+        pushChar(thread, la <= lb);
+        thread->pc += 1;
+        break;
+
+    case OP_SEQBYTE: // push byte [$sp] == [$sp+1]
+        ca = popChar(thread);
+        cb = popChar(thread);
+        pushChar(thread, ca == cb);
+        thread->pc += 1;
+        break;
+
+    case OP_SEQWORD: // push byte [$sp] == [$sp+2]
+        ia = popInt(thread);
+        ib = popInt(thread);
+        pushChar(thread, ia == ib);
+        thread->pc += 1;
+        break;
+
+    case OP_SEQDWORD: // push byte [$sp] == [$sp+4]
+        la = popLong(thread);
+        lb = popLong(thread);
+        pushChar(thread, la == lb);
+        thread->pc += 1;
+        break;
+
+    case OP_SNEBYTE: // push byte [$sp] != [$sp+1]
+        ca = popChar(thread);
+        cb = popChar(thread);
+        pushChar(thread, ca != cb);
+        thread->pc += 1;
+        break;
+
+    case OP_SNEWORD: // push byte [$sp] != [$sp+2]
+        ia = popInt(thread);
+        ib = popInt(thread);
+        pushChar(thread, ia != ib);
+        thread->pc += 1;
+        break;
+
+    case OP_SNEDWORD: // push byte [$sp] != [$sp+4]
+        la = popLong(thread);
+        lb = popLong(thread);
+        pushChar(thread, la != lb);
+        thread->pc += 1;
+        break;
+
+    case OP_SLTUBYTE: // push byte [$sp] < [$sp+1] (unsigned)
+        ca = popChar(thread);
+        cb = popChar(thread);
+        pushChar(thread, (unsigned char) ca < (unsigned char) cb);
+        thread->pc += 1;
+        break;
+
+    case OP_SLTUWORD: // push byte [$sp] < [$sp+2] (unsigned)
+        ia = popInt(thread);
+        ib = popInt(thread);
+        pushChar(thread, (unsigned int) ia < (unsigned int) ib);
+        thread->pc += 1;
+        break;
+
+    case OP_SLTUDWORD: // push byte [$sp] < [$sp+4] (unsigned)
+        la = popLong(thread);
+        lb = popLong(thread);
+        pushChar(thread, (unsigned long) la < (unsigned long) lb);
+        thread->pc += 1;
+        break;
+
+    case OP_SLEUBYTE: // push byte [$sp] <= [$sp+1] (unsigned)
+        ca = popChar(thread);
+        cb = popChar(thread);
+        pushChar(thread, (unsigned char) ca <= (unsigned char) cb);
+        thread->pc += 1;
+        break;
+
+    case OP_SLEUWORD: // push byte [$sp] <= [$sp+2] (unsigned)
+        ia = popInt(thread);
+        ib = popInt(thread);
+        pushChar(thread, (unsigned int) ia <= (unsigned int) ib);
+        thread->pc += 1;
+        break;
+
+    case OP_SLEUDWORD: // push byte [$sp] <= [$sp+4] (unsigned)
+        la = popLong(thread);
+        lb = popLong(thread);
+        pushChar(thread, (unsigned long) la <= (unsigned long) lb);
+        thread->pc += 1;
+        break;
+
+    case OP_JLTBYTE: // jump if [$sp] < [$sp+1]
+        ca = popChar(thread);
+        cb = popChar(thread);
+        if(ca < cb)
+            thread->pc = getPtr(thread->pc + 1);
+        else
+            thread->pc += 3;
+        break;
+
+    case OP_JLTWORD: // jump if [$sp] < [$sp+2]
+        ia = popInt(thread);
+        ib = popInt(thread);
+        if(ia < ib)
+            thread->pc = getPtr(thread->pc + 1);
+        else
+            thread->pc += 3;
+        break;
+
+    case OP_JLTDWORD: // jump if [$sp] < [$sp+4]
+        la = popLong(thread);
+        lb = popLong(thread);
+        if(la < lb)
+            thread->pc = getPtr(thread->pc + 1);
+        else
+            thread->pc += 3;
+        break;
+
+    case OP_JGEBYTE: // jump if [$sp] >= [$sp+1]
+        ca = popChar(thread);
+        cb = popChar(thread);
+        if(ca >= cb)
+            thread->pc = getPtr(thread->pc + 1);
+        else
+            thread->pc += 3;
+        break;
+
+    case OP_JGEWORD: // jump if [$sp] >= [$sp+2]
+        ia = popInt(thread);
+        ib = popInt(thread);
+        if(ia >= ib)
+            thread->pc = getPtr(thread->pc + 1);
+        else
+            thread->pc += 3;
+        break;
+
+    case OP_JGEDWORD: // jump if [$sp] >= [$sp+4]
+        la = popLong(thread);
+        lb = popLong(thread);
+        if(la >= lb)
+            thread->pc = getPtr(thread->pc + 1);
+        else
+            thread->pc += 3;
+        break;
+
+    case OP_JEQBYTE: // jump if [$sp] == [$sp+1]
+        ca = popChar(thread);
+        cb = popChar(thread);
+        if(ca == cb)
+            thread->pc = getPtr(thread->pc + 1);
+        else
+            thread->pc += 3;
+        break;
+
+    case OP_JEQWORD: // jump if [$sp] == [$sp+2]
+        ia = popInt(thread);
+        ib = popInt(thread);
+        if(ia == ib)
+            thread->pc = getPtr(thread->pc + 1);
+        else
+            thread->pc += 3;
+        break;
+
+    case OP_JEQDWORD: // jump if [$sp] == [$sp+4]
+        la = popLong(thread);
+        lb = popLong(thread);
+        if(la == lb)
+            thread->pc = getPtr(thread->pc + 1);
+        else
+            thread->pc += 3;
+        break;
+
+    case OP_JNEBYTE: // jump if [$sp] != [$sp+1]
+        ca = popChar(thread);
+        cb = popChar(thread);
+        if(ca != cb)
+            thread->pc = getPtr(thread->pc + 1);
+        else
+            thread->pc += 3;
+        break;
+
+    case OP_JNEWORD: // jump if [$sp] != [$sp+2]
+        ia = popInt(thread);
+        ib = popInt(thread);
+        if(ia != ib)
+            thread->pc = getPtr(thread->pc + 1);
+        else
+            thread->pc += 3;
+        break;
+
+    case OP_JNEDWORD: // jump if [$sp] != [$sp+4]
+        la = popLong(thread);
+        lb = popLong(thread);
+        if(la != lb)
+            thread->pc = getPtr(thread->pc + 1);
+        else
+            thread->pc += 3;
+        break;
+
+    case OP_JLTUBYTE: // jump if [$sp] < [$sp+1] (unsigned)
+        ca = popChar(thread);
+        cb = popChar(thread);
+        if((unsigned char) ca < (unsigned char) cb)
+            thread->pc = getPtr(thread->pc + 1);
+        else
+            thread->pc += 3;
+        break;
+
+    case OP_JLTUWORD: // jump if [$sp] < [$sp+2] (unsigned)
+        ia = popInt(thread);
+        ib = popInt(thread);
+        if((unsigned int) ia < (unsigned int) ib)
+            thread->pc = getPtr(thread->pc + 1);
+        else
+            thread->pc += 3;
+        break;
+
+    case OP_JLTUDWORD: // jump if [$sp] < [$sp+4] (unsigned)
+        la = popLong(thread);
+        lb = popLong(thread);
+        if((unsigned long) la < (unsigned long) lb)
+            thread->pc = getPtr(thread->pc + 1);
+        else
+            thread->pc += 3;
+        break;
+
+    case OP_JGEUBYTE: // jump if [$sp] >= [$sp+1] (unsigned)
+        ca = popChar(thread);
+        cb = popChar(thread);
+        if((unsigned char) ca >= (unsigned char) cb)
+            thread->pc = getPtr(thread->pc + 1);
+        else
+            thread->pc += 3;
+        break;
+
+    case OP_JGEUWORD: // jump if [$sp] >= [$sp+2] (unsigned)
+        ia = popInt(thread);
+        ib = popInt(thread);
+        if((unsigned int) ia >= (unsigned int) ib)
+            thread->pc = getPtr(thread->pc + 1);
+        else
+            thread->pc += 3;
+        break;
+
+    case OP_JGEUDWORD: // jump if [$sp] >= [$sp+4] (unsigned)
+        la = popLong(thread);
+        lb = popLong(thread);
+        if((unsigned long) la >= (unsigned long) lb)
+            thread->pc = getPtr(thread->pc + 1);
+        else
+            thread->pc += 3;
+        break;
+
+    case OP_ADDBYTEIMM: // [$sp] += byte imm
+        setChar(thread->sp, getChar(thread->sp) + getChar(thread->pc + 1));
+        thread->pc += 2;
+        break;
+
+    case OP_ADDWORDIMM: // [$sp] += word imm
+        setInt(thread->sp, getInt(thread->sp) + getInt(thread->pc + 1));
+        thread->pc += 3;
+        break;
+
+    case OP_ADDDWORDIMM: // [$sp] += dword imm
+        setLong(thread->sp, getLong(thread->sp) + getLong(thread->pc + 1));
+        thread->pc += 5;
+        break;
+
+    case OP_SUBBYTEIMM: // [$sp] -= byte imm
+        setChar(thread->sp, getChar(thread->sp) - getChar(thread->pc + 1));
+        thread->pc += 2;
+        break;
+
+    case OP_SUBWORDIMM: // [$sp] -= word imm
+        setInt(thread->sp, getInt(thread->sp) - getInt(thread->pc + 1));
+        thread->pc += 3;
+        break;
+
+    case OP_SUBDWORDIMM: // [$sp] -= dword imm
+        setLong(thread->sp, getLong(thread->sp) - getLong(thread->pc + 1));
+        thread->pc += 5;
+        break;
+
+    case OP_ANDBYTEIMM: // [$sp] &= byte imm
+        setChar(thread->sp, getChar(thread->sp) & getChar(thread->pc + 1));
+        thread->pc += 2;
+        break;
+
+    case OP_ANDWORDIMM: // [$sp] &= word imm
+        setInt(thread->sp, getInt(thread->sp) & getInt(thread->pc + 1));
+        thread->pc += 3;
+        break;
+
+    case OP_ANDDWORDIMM: // [$sp] &= dword imm
+        setLong(thread->sp, getLong(thread->sp) & getLong(thread->pc + 1));
+        thread->pc += 5;
+        break;
+
+    case OP_ORBYTEIMM: // [$sp] |= byte imm
+        setChar(thread->sp, getChar(thread->sp) | getChar(thread->pc + 1));
+        thread->pc += 2;
+        break;
+
+    case OP_ORWORDIMM: // [$sp] |= word imm
+        setInt(thread->sp, getInt(thread->sp) | getInt(thread->pc + 1));
+        thread->pc += 3;
+        break;
+
+    case OP_ORDWORDIMM: // [$sp] |= dword imm
+        setLong(thread->sp, getLong(thread->sp) | getLong(thread->pc + 1));
+        thread->pc += 5;
+        break;
+
+    case OP_XORBYTEIMM: // [$sp] ^= byte imm
+        setChar(thread->sp, getChar(thread->sp) ^ getChar(thread->pc + 1));
+        thread->pc += 2;
+        break;
+
+    case OP_XORWORDIMM: // [$sp] ^= word imm
+        setInt(thread->sp, getInt(thread->sp) ^ getInt(thread->pc + 1));
+        thread->pc += 3;
+        break;
+
+    case OP_XORDWORDIMM: // [$sp] ^= dword imm
+        setLong(thread->sp, getLong(thread->sp) ^ getLong(thread->pc + 1));
+        thread->pc += 5;
+        break;
+
+    case OP_MULBYTEIMM: // [$sp] *= byte imm
+        setChar(thread->sp, getChar(thread->sp) * getChar(thread->pc + 1));
+        thread->pc += 2;
+        break;
+
+    case OP_MULWORDIMM: // [$sp] *= word imm
+        setInt(thread->sp, getInt(thread->sp) * getInt(thread->pc + 1));
+        thread->pc += 3;
+        break;
+
+    case OP_MULDWORDIMM: // [$sp] *= dword imm
+        setLong(thread->sp, getLong(thread->sp) * getLong(thread->pc + 1));
+        thread->pc += 5;
+        break;
+
+    case OP_INCBYTEFP: // byte [$fp+c] += imm
+        addr = thread->fp + getInt(thread->pc + 1);
+        setChar(addr, getChar(addr) + getChar(thread->pc + 3));
+        thread->pc += 4;
+        break;
+
+    case OP_INCWORDFP: // word [$fp+c] += imm
+        addr = thread->fp + getInt(thread->pc + 1);
+        setInt(addr, getInt(addr) + getInt(thread->pc + 3));
+        thread->pc += 5;
+        break;
+
+    case OP_INCDWORDFP: // dword [$fp+c] += imm
+        addr = thread->fp + getInt(thread->pc + 1);
+        setLong(addr, getLong(addr) + getLong(thread->pc + 3));
+        thread->pc += 7;
+        break;
+
+    case OP_PUSHBYTEADDRIDX: // push byte [label + index*scale], index popped
+        addr = (char*) getPtr(thread->pc + 1) + popInt(thread) * (unsigned char) getChar(thread->pc + 3);
+        pushChar(thread, getChar(addr));
+        thread->pc += 4;
+        break;
+
+    case OP_PUSHWORDADDRIDX: // push word [label + index*scale], index popped
+        addr = (char*) getPtr(thread->pc + 1) + popInt(thread) * (unsigned char) getChar(thread->pc + 3);
+        pushInt(thread, getInt(addr));
+        thread->pc += 4;
+        break;
+
+    case OP_PUSHDWORDADDRIDX: // push dword [label + index*scale], index popped
+        addr = (char*) getPtr(thread->pc + 1) + popInt(thread) * (unsigned char) getChar(thread->pc + 3);
+        pushLong(thread, getLong(addr));
+        thread->pc += 4;
+        break;
+
+    case OP_PUSHBYTEFPIDX: // push byte [$fp+c + index*scale], index popped
+        addr = thread->fp + getInt(thread->pc + 1) + popInt(thread) * (unsigned char) getChar(thread->pc + 3);
+        pushChar(thread, getChar(addr));
+        thread->pc += 4;
+        break;
+
+    case OP_PUSHWORDFPIDX: // push word [$fp+c + index*scale], index popped
+        addr = thread->fp + getInt(thread->pc + 1) + popInt(thread) * (unsigned char) getChar(thread->pc + 3);
+        pushInt(thread, getInt(addr));
+        thread->pc += 4;
+        break;
+
+    case OP_PUSHDWORDFPIDX: // push dword [$fp+c + index*scale], index popped
+        addr = thread->fp + getInt(thread->pc + 1) + popInt(thread) * (unsigned char) getChar(thread->pc + 3);
+        pushLong(thread, getLong(addr));
+        thread->pc += 4;
+        break;
+
+    case OP_PUSHBYTEDISP: // push byte [ptr + d], ptr popped
+        addr = (char*) popPtr(thread) + getInt(thread->pc + 1);
+        pushChar(thread, getChar(addr));
+        thread->pc += 3;
+        break;
+
+    case OP_PUSHWORDDISP: // push word [ptr + d], ptr popped
+        addr = (char*) popPtr(thread) + getInt(thread->pc + 1);
+        pushInt(thread, getInt(addr));
+        thread->pc += 3;
+        break;
+
+    case OP_PUSHDWORDDISP: // push dword [ptr + d], ptr popped
+        addr = (char*) popPtr(thread) + getInt(thread->pc + 1);
+        pushLong(thread, getLong(addr));
+        thread->pc += 3;
+        break;
+
+    case OP_POPBYTEADDRIDX: // pop byte [label + index*scale], index popped first
+        addr = (char*) getPtr(thread->pc + 1) + popInt(thread) * (unsigned char) getChar(thread->pc + 3);
+        setChar(addr, popChar(thread));
+        thread->pc += 4;
+        break;
+
+    case OP_POPWORDADDRIDX: // pop word [label + index*scale], index popped first
+        addr = (char*) getPtr(thread->pc + 1) + popInt(thread) * (unsigned char) getChar(thread->pc + 3);
+        setInt(addr, popInt(thread));
+        thread->pc += 4;
+        break;
+
+    case OP_POPDWORDADDRIDX: // pop dword [label + index*scale], index popped first
+        addr = (char*) getPtr(thread->pc + 1) + popInt(thread) * (unsigned char) getChar(thread->pc + 3);
+        setLong(addr, popLong(thread));
+        thread->pc += 4;
+        break;
+
+    case OP_POPBYTEFPIDX: // pop byte [$fp+c + index*scale], index popped first
+        addr = thread->fp + getInt(thread->pc + 1) + popInt(thread) * (unsigned char) getChar(thread->pc + 3);
+        setChar(addr, popChar(thread));
+        thread->pc += 4;
+        break;
+
+    case OP_POPWORDFPIDX: // pop word [$fp+c + index*scale], index popped first
+        addr = thread->fp + getInt(thread->pc + 1) + popInt(thread) * (unsigned char) getChar(thread->pc + 3);
+        setInt(addr, popInt(thread));
+        thread->pc += 4;
+        break;
+
+    case OP_POPDWORDFPIDX: // pop dword [$fp+c + index*scale], index popped first
+        addr = thread->fp + getInt(thread->pc + 1) + popInt(thread) * (unsigned char) getChar(thread->pc + 3);
+        setLong(addr, popLong(thread));
+        thread->pc += 4;
+        break;
+
+    case OP_POPBYTEDISP: // pop byte [ptr + d], ptr popped first
+        addr = (char*) popPtr(thread) + getInt(thread->pc + 1);
+        setChar(addr, popChar(thread));
+        thread->pc += 3;
+        break;
+
+    case OP_POPWORDDISP: // pop word [ptr + d], ptr popped first
+        addr = (char*) popPtr(thread) + getInt(thread->pc + 1);
+        setInt(addr, popInt(thread));
+        thread->pc += 3;
+        break;
+
+    case OP_POPDWORDDISP: // pop dword [ptr + d], ptr popped first
+        addr = (char*) popPtr(thread) + getInt(thread->pc + 1);
+        setLong(addr, popLong(thread));
+        thread->pc += 3;
+        break;
+
+    case OP_PUSHFPS: // push $fp+c
+        pushPtr(thread, thread->fp + (signed char) getChar(thread->pc + 1));
+        thread->pc += 2;
+        break;
+
+    case OP_PUSHBYTEFPS: // push byte [$fp+c]
+        addr = thread->fp + (signed char) getChar(thread->pc + 1);
+        pushChar(thread, getChar(addr));
+        thread->pc += 2;
+        break;
+
+    case OP_PUSHWORDFPS: // push word [$fp+c]
+        addr = thread->fp + (signed char) getChar(thread->pc + 1);
+        pushInt(thread, getInt(addr));
+        thread->pc += 2;
+        break;
+
+    case OP_PUSHDWORDFPS: // push dword [$fp+c]
+        addr = thread->fp + (signed char) getChar(thread->pc + 1);
+        pushLong(thread, getLong(addr));
+        thread->pc += 2;
+        break;
+
+    case OP_POPBYTEFPS: // pop byte [$fp+c]
+        addr = thread->fp + (signed char) getChar(thread->pc + 1);
+        setChar(addr, popChar(thread));
+        thread->pc += 2;
+        break;
+
+    case OP_POPWORDFPS: // pop word [$fp+c]
+        addr = thread->fp + (signed char) getChar(thread->pc + 1);
+        setInt(addr, popInt(thread));
+        thread->pc += 2;
+        break;
+
+    case OP_POPDWORDFPS: // pop dword [$fp+c]
+        addr = thread->fp + (signed char) getChar(thread->pc + 1);
+        setLong(addr, popLong(thread));
+        thread->pc += 2;
+        break;
+
+    case OP_PUSHWORDIMMS: // push word imm, sign extended from a byte
+        pushInt(thread, (signed char) getChar(thread->pc + 1));
+        thread->pc += 2;
+        break;
+
+    case OP_PUSHDWORDIMMS: // push dword imm, sign extended from a byte
+        pushLong(thread, (signed char) getChar(thread->pc + 1));
+        thread->pc += 2;
+        break;
+
+    case OP_PUSHIMMS: // reduce $sp with an unsigned byte
+        thread->sp -= (unsigned char) getChar(thread->pc + 1);
+        thread->pc += 2;
+        break;
+
+    case OP_POPIMMS: // increase $sp with an unsigned byte
+        thread->sp += (unsigned char) getChar(thread->pc + 1);
+        thread->pc += 2;
+        break;
+
+    case OP_PUSHWORDLOC0:
+    case OP_PUSHWORDLOC1:
+    case OP_PUSHWORDLOC2:
+    case OP_PUSHWORDLOC3: // push word [$fp-2-2n]
+        addr = thread->fp - 2*((unsigned char) getChar(thread->pc) - OP_PUSHWORDLOC0 + 1);
+        pushInt(thread, getInt(addr));
+        thread->pc += 1;
+        break;
+
+    case OP_POPWORDLOC0:
+    case OP_POPWORDLOC1:
+    case OP_POPWORDLOC2:
+    case OP_POPWORDLOC3: // pop word [$fp-2-2n]
+        addr = thread->fp - 2*((unsigned char) getChar(thread->pc) - OP_POPWORDLOC0 + 1);
+        setInt(addr, popInt(thread));
+        thread->pc += 1;
+        break;
+
+    case OP_PUSHWORDARG0:
+    case OP_PUSHWORDARG1: // push word [$fp+4+2n]
+        addr = thread->fp + 4 + 2*((unsigned char) getChar(thread->pc) - OP_PUSHWORDARG0);
+        pushInt(thread, getInt(addr));
+        thread->pc += 1;
+        break;
+
+    case OP_JMPS:
+        thread->pc += 2 + (signed char) getChar(thread->pc + 1);
+        break;
+
+    case OP_JEZS:
+        ca = popChar(thread);
+        if(ca == 0)
+            thread->pc += 2 + (signed char) getChar(thread->pc + 1);
+        else
+            thread->pc += 2;
+        break;
+
+    case OP_JNEZS:
+        ca = popChar(thread);
+        if(ca != 0)
+            thread->pc += 2 + (signed char) getChar(thread->pc + 1);
+        else
+            thread->pc += 2;
+        break;
+
+    case OP_TABLESWITCH: ; // jump to target [index], or to the default one
+        unsigned int index = popInt(thread);
+        if(index < (unsigned char) getChar(thread->pc + 1))
+            thread->pc = getPtr(thread->pc + 4 + 2*index);
+        else
+            thread->pc = getPtr(thread->pc + 2);
+        break;
+
+    case OP_IN: // push byte [c] & mask
+        pushChar(thread, *(volatile char*) getPtr(thread->pc + 1) & getChar(thread->pc + 3));
+        thread->pc += 4;
+        break;
+
+    case OP_OUT: // pop byte into the masked bits of [c]
+        ca = popChar(thread);
+        cb = getChar(thread->pc + 3);
+        ioModify(getPtr(thread->pc + 1), cb, ca & cb);
+        thread->pc += 4;
+        break;
+
+    case OP_SBI: // set the masked bits of [c]
+        ioModify(getPtr(thread->pc + 1), 0, getChar(thread->pc + 3));
+        thread->pc += 4;
+        break;
+
+    case OP_CBI: // clear the masked bits of [c]
+        ioModify(getPtr(thread->pc + 1), getChar(thread->pc + 3), 0);
+        thread->pc += 4;
+        break;
+
+    case OP_DJNZWORDFP: ; // [$fp+c] -= 1, jump if nonzero
+        addr = thread->fp + getInt(thread->pc + 1);
+        ia = getInt(addr) - 1;
+        setInt(addr, ia);
+        if(ia != 0)
+            thread->pc = getPtr(thread->pc + 3);
+        else
+            thread->pc += 5;
+        break;
+
+    case OP_TAILCALL: ;
+        tailCall(thread, getPtr(thread->pc + 1), getChar(thread->pc + 3), getChar(thread->pc + 4));
+        break;
+
+    case OP_SLEEP: ; // pop word ms, and continue that much later than the current baseline
+        unsigned int ms = popInt(thread);
+        thread->pc += 1;
+        if(CAN_PARK(thread))
+        {
+            parkVmThread(thread, argBin, MSEC(ms));
+            return false;
+        }
+        break;
+
+    case OP_AWAIT: ; // pop semaphore address, take one from it or wait for a notify
+        char* sem = popPtr(thread);
+        thread->pc += 1;
+        char sreg = SREG;
+        cli();
+        if(getInt(sem) > 0)
+        {
+            setInt(sem, getInt(sem) - 1);
+            SREG = sreg;
+            pushChar(thread, 1);
+        }
+        else if(CAN_PARK(thread))
+        {
+            pushChar(thread, 1);
+            argBin->thread = thread;
+            argBin->methodAddr = thread->pc;
+            addVmWaiter(sem, argBin);
+            SREG = sreg;
+            return false;
+        }
+        else
+        {
+            SREG = sreg;
+            pushChar(thread, 0);
+        }
+        break;
+
+    case OP_NOTIFY: ; // pop semaphore address, wake its first waiter or add one to it
+        sem = popPtr(thread);
+        thread->pc += 1;
+        sreg = SREG;
+        cli();
+        VmArgBin* waiter = getPtr(sem + 2);
+        if(waiter)
+            setPtr(sem + 2, waiter->next);
+        else
+            setInt(sem, getInt(sem) + 1);
+        SREG = sreg;
+        if(waiter)
+            BEFORE(CURRENT_DEADLINE(), waiter->thread->obj, exec, waiter);
+        break;
+
+    case OP_CHSEND: ; // pop channel address and item, push 1 if the item fit
+        char* channel = popPtr(thread);
+        unsigned char itemSize = getChar(thread->pc + 1);
+        unsigned char tail = getChar(channel + CHANNEL_TAIL);
+        unsigned char next = tail + 1 < (unsigned char) getChar(channel + CHANNEL_SLOTS) ? tail + 1 : 0;
+        thread->pc += 2;
+        if(next == (unsigned char) getChar(channel + CHANNEL_HEAD))
+        {
+            thread->sp += itemSize;
+            pushChar(thread, 0);
+            break;
+        }
+        popArray(channel + CHANNEL_DATA + tail*itemSize, thread, itemSize);
+        sreg = SREG;
+        cli();
+        setChar(channel + CHANNEL_TAIL, next);
+        waiter = getPtr(channel + CHANNEL_WAITER);
+        setPtr(channel + CHANNEL_WAITER, 0);
+        SREG = sreg;
+        if(waiter)
+            BEFORE(CURRENT_DEADLINE(), waiter->thread->obj, exec, waiter);
+        pushChar(thread, 1);
+        break;
+
+    case OP_CHRECV: ; // pop channel address, push its oldest item and 1 or wait for one
+        channel = popPtr(thread);
+        itemSize = getChar(thread->pc + 1);
+        unsigned char head = getChar(channel + CHANNEL_HEAD);
+        if(head == (unsigned char) getChar(channel + CHANNEL_TAIL) && CAN_PARK(thread))
+        {
+            // Wait, unless the producer sent something before we could tell it to wake us
+            sreg = SREG;
+            cli();
+            if(head == (unsigned char) getChar(channel + CHANNEL_TAIL))
+            {
+                // We come back to this CHRECV with the channel address on the stack again
+                pushPtr(thread, channel);
+                argBin->thread = thread;
+                argBin->methodAddr = thread->pc;
+                setPtr(channel + CHANNEL_WAITER, argBin);
+                SREG = sreg;
+                return false;
+            }
+            SREG = sreg;
+        }
+        thread->pc += 2;
+        if(head != (unsigned char) getChar(channel + CHANNEL_TAIL))
+        {
+            pushArray(thread, channel + CHANNEL_DATA + head*itemSize, itemSize);
+            setChar(channel + CHANNEL_HEAD, head + 1 < (unsigned char) getChar(channel + CHANNEL_SLOTS) ? head + 1 : 0);
+            pushChar(thread, 1);
+        }
+        else
+        {
+            thread->sp -= itemSize;
+            memset(thread->sp, 0, itemSize);
+            pushChar(thread, 0);
+        }
+        break;
+
+    case OP_FPOLL: // pop future address, push its state
+        future = popPtr(thread);
+        pushChar(thread, getInt(future + FUTURE_STATE));
+        thread->pc += 1;
+        break;
+
+    case OP_FAWAIT: // pop future address, wait for the call to return and push the state
+        future = popPtr(thread);
+        thread->pc += 1;
+        sreg = SREG;
+        cli();
+        if(getInt(future + FUTURE_STATE) != FUTURE_PENDING)
+        {
+            SREG = sreg;
+            pushChar(thread, getInt(future + FUTURE_STATE));
+        }
+        else if(CAN_PARK(thread))
+        {
+            // Only a return wakes us, so it's done by then
+            pushChar(thread, FUTURE_DONE);
+            argBin->thread = thread;
+            argBin->methodAddr = thread->pc;
+            addVmWaiter(future, argBin);
+            SREG = sreg;
+            return false;
+        }
+        else
+        {
+            SREG = sreg;
+            pushChar(thread, 0);
+        }
+        break;
+
+    case OP_HOT: // not translated
+        thread->pc += 2;
+        break;
+    }
+    return true;
+}
+
+#if VM_DISPATCH == VM_DISPATCH_THREADED
+
+// Threaded interpreter core. $pc, $sp and $fp are kept in locals and every handler jumps
+// straight to the next one through the dispatch table. The thread object is only written
+// back when we leave the loop, which is on the final RET of this exec and on the opcodes
+// handed over to executeInstruction (SYNC, ASYNC, CALLE and anything else without a
+// handler of its own down here)
+#define NEXT() { COUNT_INSTRUCTION(pc); if(QUANTUM_EXPIRED()) goto park; \
+                 goto *(void*) pgm_read_word(dispatchTable + (unsigned char) getChar(pc)); }
+#define SAVE() { thread->pc = pc; thread->sp = sp; thread->fp = fp; }
+#define LOAD() { pc = thread->pc; sp = thread->sp; fp = thread->fp; }
+
+#define BYTEOP(op) { ca = getChar(sp); cb = getChar(sp + 1); sp += 1; setChar(sp, ca op cb); pc += 1; NEXT(); }
+#define WORDOP(op) { ia = getInt(sp); ib = getInt(sp + 2); sp += 2; setInt(sp, ia op ib); pc += 1; NEXT(); }
+#define DWORDOP(op) { la = getLong(sp); lb = getLong(sp + 4); sp += 4; setLong(sp, la op lb); pc += 1; NEXT(); }
+
+// Compare with zero, the byte sized result replaces the operand
+#define BYTETEST(cond) { ca = getChar(sp); setChar(sp, ca cond); pc += 1; NEXT(); }
+#define WORDTEST(cond) { ia = getInt(sp); sp += 1; setChar(sp, ia cond); pc += 1; NEXT(); }
+#define DWORDTEST(cond) { la = getLong(sp); sp += 3; setChar(sp, la cond); pc += 1; NEXT(); }
+
+// Two-operand compares, [$sp] on the left. type picks signed or unsigned comparison
+#define BYTECMP(type, op) { ca = getChar(sp); cb = getChar(sp + 1); sp += 1; setChar(sp, (type) ca op (type) cb); pc += 1; NEXT(); }
+#define WORDCMP(type, op) { ia = getInt(sp); ib = getInt(sp + 2); sp += 3; setChar(sp, (type) ia op (type) ib); pc += 1; NEXT(); }
+#define DWORDCMP(type, op) { la = getLong(sp); lb = getLong(sp + 4); sp += 7; setChar(sp, (type) la op (type) lb); pc += 1; NEXT(); }
+#define BYTEJUMP(type, op) { ca = getChar(sp); cb = getChar(sp + 1); sp += 2; pc = (type) ca op (type) cb ? getPtr(pc + 1) : pc + 3; NEXT(); }
+#define WORDJUMP(type, op) { ia = getInt(sp); ib = getInt(sp + 2); sp += 4; pc = (type) ia op (type) ib ? getPtr(pc + 1) : pc + 3; NEXT(); }
+#define DWORDJUMP(type, op) { la = getLong(sp); lb = getLong(sp + 4); sp += 8; pc = (type) la op (type) lb ? getPtr(pc + 1) : pc + 3; NEXT(); }
+
+// Immediate right hand side following the opcode, the result replaces [$sp]
+#define IMMOP(get, set, size, op) { set(sp, get(sp) op get(pc + 1)); pc += 1 + size; NEXT(); }
+
+// Indexed loads and stores, the index is on top and the scale byte follows base
+#define LOADINDEXED(get, set, size, base) { addr = base + getInt(sp) * (unsigned char) getChar(pc + 3); \
+        sp += 2 - size; set(sp, get(addr)); pc += 4; NEXT(); }
+#define STOREINDEXED(get, set, size, base) { addr = base + getInt(sp) * (unsigned char) getChar(pc + 3); \
+        set(addr, get(sp + 2)); sp += 2 + size; pc += 4; NEXT(); }
+
+// Loads and stores through the pointer on top, displaced by d
+#define LOADDISPLACED(get, set, size) { addr = (char*) getPtr(sp) + getInt(pc + 1); \
+        sp += 2 - size; set(sp, get(addr)); pc += 3; NEXT(); }
+#define STOREDISPLACED(get, set, size) { addr = (char*) getPtr(sp) + getInt(pc + 1); \
+        set(addr, get(sp + 2)); sp += 2 + size; pc += 3; NEXT(); }
+
+// Operand-less word locals and arguments at a fixed offset from $fp
+#define PUSHLOCAL(offset) { sp -= 2; setInt(sp, getInt(fp + offset)); pc += 1; NEXT(); }
+#define POPLOCAL(offset) { setInt(fp + offset, getInt(sp)); sp += 2; pc += 1; NEXT(); }
+
+// Shift by immediate, and shift by a byte count found below the operand
+#define SHIFT(get, set, cast, op) { set(sp, (cast) get(sp) op getChar(pc + 1)); pc += 2; NEXT(); }
+#define SHIFTV(get, set, size, cast, op) { ca = getChar(sp + size); set(sp + 1, (cast) get(sp) op ca); sp += 1; pc += 1; NEXT(); }
+
+void runThreaded(VmThread* thread, VmArgBin* argBin)
+{
+    static const void* const PROGMEM dispatchTable[256] =
+    {
+        [0 ... 255] = &&fallback,
+        [OP_PUSHFP] = &&op_pushfp,
+        [OP_PUSHIMM] = &&op_pushimm,
+        [OP_PUSHADDR] = &&op_pushaddr,
+        [OP_PUSHBYTEFP] = &&op_pushbytefp,
+        [OP_PUSHWORDFP] = &&op_pushwordfp,
+        [OP_PUSHDWORDFP] = &&op_pushdwordfp,
+        [OP_PUSHBYTEADDR] = &&op_pushbyteaddr,
+        [OP_PUSHWORDADDR] = &&op_pushwordaddr,
+        [OP_PUSHDWORDADDR] = &&op_pushdwordaddr,
+        [OP_PUSHBYTEIMM] = &&op_pushbyteimm,
+        [OP_PUSHWORDIMM] = &&op_pushwordimm,
+        [OP_PUSHDWORDIMM] = &&op_pushdwordimm,
+        [OP_PUSHBYTE] = &&op_pushbyte,
+        [OP_PUSHWORD] = &&op_pushword,
+        [OP_PUSHDWORD] = &&op_pushdword,
+        [OP_POPIMM] = &&op_popimm,
+        [OP_POPBYTEFP] = &&op_popbytefp,
+        [OP_POPWORDFP] = &&op_popwordfp,
+        [OP_POPDWORDFP] = &&op_popdwordfp,
+        [OP_POPBYTEADDR] = &&op_popbyteaddr,
+        [OP_POPWORDADDR] = &&op_popwordaddr,
+        [OP_POPDWORDADDR] = &&op_popdwordaddr,
+        [OP_POPBYTE] = &&op_popbyte,
+        [OP_POPWORD] = &&op_popword,
+        [OP_POPDWORD] = &&op_popdword,
+        [OP_CALL] = &&op_call,
+        [OP_RET] = &&op_ret,
+        [OP_ADDBYTE] = &&op_addbyte,
+        [OP_ADDWORD] = &&op_addword,
+        [OP_ADDDWORD] = &&op_adddword,
+        [OP_SUBBYTE] = &&op_subbyte,
+        [OP_SUBWORD] = &&op_subword,
+        [OP_SUBDWORD] = &&op_subdword,
+        [OP_MULBYTE] = &&op_mulbyte,
+        [OP_MULWORD] = &&op_mulword,
+        [OP_MULDWORD] = &&op_muldword,
+        [OP_DIVBYTE] = &&op_divbyte,
+        [OP_DIVWORD] = &&op_divword,
+        [OP_DIVDWORD] = &&op_divdword,
+        [OP_MODBYTE] = &&op_modbyte,
+        [OP_MODWORD] = &&op_modword,
+        [OP_MODDWORD] = &&op_moddword,
+        [OP_ANDBYTE] = &&op_andbyte,
+        [OP_ANDWORD] = &&op_andword,
+        [OP_ANDDWORD] = &&op_anddword,
+        [OP_ORBYTE] = &&op_orbyte,
+        [OP_ORWORD] = &&op_orword,
+        [OP_ORDWORD] = &&op_ordword,
+        [OP_XORBYTE] = &&op_xorbyte,
+        [OP_XORWORD] = &&op_xorword,
+        [OP_XORDWORD] = &&op_xordword,
+        [OP_SGZBYTE] = &&op_sgzbyte,
+        [OP_SGZWORD] = &&op_sgzword,
+        [OP_SGZDWORD] = &&op_sgzdword,
+        [OP_SGEZBYTE] = &&op_sgezbyte,
+        [OP_SGEZWORD] = &&op_sgezword,
+        [OP_SGEZDWORD] = &&op_sgezdword,
+        [OP_SEZBYTE] = &&op_sezbyte,
+        [OP_SEZWORD] = &&op_sezword,
+        [OP_SEZDWORD] = &&op_sezdword,
+        [OP_SNEZBYTE] = &&op_snezbyte,
+        [OP_SNEZWORD] = &&op_snezword,
+        [OP_SNEZDWORD] = &&op_snezdword,
+        [OP_JMP] = &&op_jmp,
+        [OP_JEZ] = &&op_jez,
+        [OP_JNEZ] = &&op_jnez,
+        [OP_SLLBYTE] = &&op_sllbyte,
+        [OP_SLLWORD] = &&op_sllword,
+        [OP_SLLDWORD] = &&op_slldword,
+        [OP_SLLVBYTE] = &&op_sllvbyte,
+        [OP_SLLVWORD] = &&op_sllvword,
+        [OP_SLLVDWORD] = &&op_sllvdword,
+        [OP_SRLBYTE] = &&op_srlbyte,
+        [OP_SRLWORD] = &&op_srlword,
+        [OP_SRLDWORD] = &&op_srldword,
+        [OP_SRLVBYTE] = &&op_srlvbyte,
+        [OP_SRLVWORD] = &&op_srlvword,
+        [OP_SRLVDWORD] = &&op_srlvdword,
+        [OP_SRABYTE] = &&op_srabyte,
+        [OP_SRAWORD] = &&op_sraword,
+        [OP_SRADWORD] = &&op_sradword,
+        [OP_SRAVBYTE] = &&op_sravbyte,
+        [OP_SRAVWORD] = &&op_sravword,
+        [OP_SRAVDWORD] = &&op_sravdword,
+        [OP_ADDWORDFPFP] = &&op_addwordfpfp,
+        [OP_SUBWORDFPFP] = &&op_subwordfpfp,
+        [OP_ADDWORDFPIMM] = &&op_addwordfpimm,
+        [OP_PUSH2WORDFP] = &&op_push2wordfp,
+        [OP_MOVWORDFP] = &&op_movwordfp,
+        [OP_MOVWORDIMMFP] = &&op_movwordimmfp,
+        [OP_SLTBYTE] = &&op_sltbyte,
+        [OP_SLTWORD] = &&op_sltword,
+        [OP_SLTDWORD] = &&op_sltdword,
+        [OP_SLEBYTE] = &&op_slebyte,
+        [OP_SLEWORD] = &&op_sleword,
+        [OP_SLEDWORD] = &&op_sledword,
+        [OP_SEQBYTE] = &&op_seqbyte,
+        [OP_SEQWORD] = &&op_seqword,
+        [OP_SEQDWORD] = &&op_seqdword,
+        [OP_SNEBYTE] = &&op_snebyte,
+        [OP_SNEWORD] = &&op_sneword,
+        [OP_SNEDWORD] = &&op_snedword,
+        [OP_SLTUBYTE] = &&op_sltubyte,
+        [OP_SLTUWORD] = &&op_sltuword,
+        [OP_SLTUDWORD] = &&op_sltudword,
+        [OP_SLEUBYTE] = &&op_sleubyte,
+        [OP_SLEUWORD] = &&op_sleuword,
+        [OP_SLEUDWORD] = &&op_sleudword,
+        [OP_JLTBYTE] = &&op_jltbyte,
+        [OP_JLTWORD] = &&op_jltword,
+        [OP_JLTDWORD] = &&op_jltdword,
+        [OP_JGEBYTE] = &&op_jgebyte,
+        [OP_JGEWORD] = &&op_jgeword,
+        [OP_JGEDWORD] = &&op_jgedword,
+        [OP_JEQBYTE] = &&op_jeqbyte,
+        [OP_JEQWORD] = &&op_jeqword,
+        [OP_JEQDWORD] = &&op_jeqdword,
+        [OP_JNEBYTE] = &&op_jnebyte,
+        [OP_JNEWORD] = &&op_jneword,
+        [OP_JNEDWORD] = &&op_jnedword,
+        [OP_JLTUBYTE] = &&op_jltubyte,
+        [OP_JLTUWORD] = &&op_jltuword,
+        [OP_JLTUDWORD] = &&op_jltudword,
+        [OP_JGEUBYTE] = &&op_jgeubyte,
+        [OP_JGEUWORD] = &&op_jgeuword,
+        [OP_JGEUDWORD] = &&op_jgeudword,
+        [OP_ADDBYTEIMM] = &&op_addbyteimm,
+        [OP_ADDWORDIMM] = &&op_addwordimm,
+        [OP_ADDDWORDIMM] = &&op_adddwordimm,
+        [OP_SUBBYTEIMM] = &&op_subbyteimm,
+        [OP_SUBWORDIMM] = &&op_subwordimm,
+        [OP_SUBDWORDIMM] = &&op_subdwordimm,
+        [OP_ANDBYTEIMM] = &&op_andbyteimm,
+        [OP_ANDWORDIMM] = &&op_andwordimm,
+        [OP_ANDDWORDIMM] = &&op_anddwordimm,
+        [OP_ORBYTEIMM] = &&op_orbyteimm,
+        [OP_ORWORDIMM] = &&op_orwordimm,
+        [OP_ORDWORDIMM] = &&op_ordwordimm,
+        [OP_XORBYTEIMM] = &&op_xorbyteimm,
+        [OP_XORWORDIMM] = &&op_xorwordimm,
+        [OP_XORDWORDIMM] = &&op_xordwordimm,
+        [OP_MULBYTEIMM] = &&op_mulbyteimm,
+        [OP_MULWORDIMM] = &&op_mulwordimm,
+        [OP_MULDWORDIMM] = &&op_muldwordimm,
+        [OP_INCBYTEFP] = &&op_incbytefp,
+        [OP_INCWORDFP] = &&op_incwordfp,
+        [OP_INCDWORDFP] = &&op_incdwordfp,
+        [OP_PUSHBYTEADDRIDX] = &&op_pushbyteaddridx,
+        [OP_PUSHWORDADDRIDX] = &&op_pushwordaddridx,
+        [OP_PUSHDWORDADDRIDX] = &&op_pushdwordaddridx,
+        [OP_PUSHBYTEFPIDX] = &&op_pushbytefpidx,
+        [OP_PUSHWORDFPIDX] = &&op_pushwordfpidx,
+        [OP_PUSHDWORDFPIDX] = &&op_pushdwordfpidx,
+        [OP_PUSHBYTEDISP] = &&op_pushbytedisp,
+        [OP_PUSHWORDDISP] = &&op_pushworddisp,
+        [OP_PUSHDWORDDISP] = &&op_pushdworddisp,
+        [OP_POPBYTEADDRIDX] = &&op_popbyteaddridx,
+        [OP_POPWORDADDRIDX] = &&op_popwordaddridx,
+        [OP_POPDWORDADDRIDX] = &&op_popdwordaddridx,
+        [OP_POPBYTEFPIDX] = &&op_popbytefpidx,
+        [OP_POPWORDFPIDX] = &&op_popwordfpidx,
+        [OP_POPDWORDFPIDX] = &&op_popdwordfpidx,
+        [OP_POPBYTEDISP] = &&op_popbytedisp,
+        [OP_POPWORDDISP] = &&op_popworddisp,
+        [OP_POPDWORDDISP] = &&op_popdworddisp,
+        [OP_PUSHFPS] = &&op_pushfps,
+        [OP_PUSHBYTEFPS] = &&op_pushbytefps,
+        [OP_PUSHWORDFPS] = &&op_pushwordfps,
+        [OP_PUSHDWORDFPS] = &&op_pushdwordfps,
+        [OP_POPBYTEFPS] = &&op_popbytefps,
+        [OP_POPWORDFPS] = &&op_popwordfps,
+        [OP_POPDWORDFPS] = &&op_popdwordfps,
+        [OP_PUSHWORDIMMS] = &&op_pushwordimms,
+        [OP_PUSHDWORDIMMS] = &&op_pushdwordimms,
+        [OP_PUSHIMMS] = &&op_pushimms,
+        [OP_POPIMMS] = &&op_popimms,
+        [OP_PUSHWORDLOC0] = &&op_pushwordloc0,
+        [OP_PUSHWORDLOC1] = &&op_pushwordloc1,
+        [OP_PUSHWORDLOC2] = &&op_pushwordloc2,
+        [OP_PUSHWORDLOC3] = &&op_pushwordloc3,
+        [OP_POPWORDLOC0] = &&op_popwordloc0,
+        [OP_POPWORDLOC1] = &&op_popwordloc1,
+        [OP_POPWORDLOC2] = &&op_popwordloc2,
+        [OP_POPWORDLOC3] = &&op_popwordloc3,
+        [OP_PUSHWORDARG0] = &&op_pushwordarg0,
+        [OP_PUSHWORDARG1] = &&op_pushwordarg1,
+        [OP_JMPS] = &&op_jmps,
+        [OP_JEZS] = &&op_jezs,
+        [OP_JNEZS] = &&op_jnezs,
+        [OP_TABLESWITCH] = &&op_tableswitch,
+        [OP_IN] = &&op_in,
+        [OP_OUT] = &&op_out,
+        [OP_SBI] = &&op_sbi,
+        [OP_CBI] = &&op_cbi,
+        [OP_DJNZWORDFP] = &&op_djnzwordfp,
+        [OP_TAILCALL] = &&op_tailcall
+    };
+
+    char* pc;
+    char* sp;
+    char* fp;
+    void* addr;
+    char ca, cb;
+    int ia, ib;
+    long la, lb;
+#if VM_QUANTUM > 0
+    unsigned int budget = VM_QUANTUM;
+#endif
+
+    LOAD();
+    NEXT();
+
+op_pushfp: // push $fp+c
+    sp -= 2;
+    setPtr(sp, fp + getInt(pc + 1));
+    pc += 3;
+    NEXT();
+
+op_pushimm: // push imm (reduce $sp with immediate)
+    sp -= getInt(pc + 1);
+    pc += 3;
+    NEXT();
+
+op_pushaddr: // push label
+    sp -= 2;
+    setInt(sp, getInt(pc + 1));
+    pc += 3;
+    NEXT();
+
+op_pushbytefp: // push byte [$fp+c]
+    sp -= 1;
+    setChar(sp, getChar(fp + getInt(pc + 1)));
+    pc += 3;
+    NEXT();
+
+op_pushwordfp: // push word [$fp+c]
+    sp -= 2;
+    setInt(sp, getInt(fp + getInt(pc + 1)));
+    pc += 3;
+    NEXT();
+
+op_pushdwordfp: // push dword [$fp+c]
+    sp -= 4;
+    setLong(sp, getLong(fp + getInt(pc + 1)));
+    pc += 3;
+    NEXT();
+
+op_pushbyteaddr: // push byte [label]
+    sp -= 1;
+    setChar(sp, getChar(getPtr(pc + 1)));
+    pc += 3;
+    NEXT();
+
+op_pushwordaddr: // push word [label]
+    sp -= 2;
+    setInt(sp, getInt(getPtr(pc + 1)));
+    pc += 3;
+    NEXT();
+
+op_pushdwordaddr: // push dword [label]
+    sp -= 4;
+    setLong(sp, getLong(getPtr(pc + 1)));
+    pc += 3;
+    NEXT();
+
+op_pushbyteimm: // push byte imm
+    sp -= 1;
+    setChar(sp, getChar(pc + 1));
+    pc += 2;
+    NEXT();
+
+op_pushwordimm: // push word imm
+    sp -= 2;
+    setInt(sp, getInt(pc + 1));
+    pc += 3;
+    NEXT();
+
+op_pushdwordimm: // push dword imm
+    sp -= 4;
+    setLong(sp, getLong(pc + 1));
+    pc += 5;
+    NEXT();
+
+op_pushbyte: // replace [$sp] with byte [[$sp]]
+    addr = getPtr(sp);
+    sp += 1;
+    setChar(sp, getChar(addr));
+    pc += 1;
+    NEXT();
+
+op_pushword: // replace [$sp] with word [[$sp]]
+    setInt(sp, getInt(getPtr(sp)));
+    pc += 1;
+    NEXT();
+
+op_pushdword: // replace [$sp] with dword [[$sp]]
+    addr = getPtr(sp);
+    sp -= 2;
+    setLong(sp, getLong(addr));
+    pc += 1;
+    NEXT();
+
+op_popimm:
+    sp += getInt(pc + 1);
+    pc += 3;
+    NEXT();
+
+op_popbytefp: // pop byte [$fp + c]
+    setChar(fp + getInt(pc + 1), getChar(sp));
+    sp += 1;
+    pc += 3;
+    NEXT();
+
+op_popwordfp: // pop word [$fp + c]
+    setInt(fp + getInt(pc + 1), getInt(sp));
+    sp += 2;
+    pc += 3;
+    NEXT();
+
+op_popdwordfp: // pop dword [$fp + c]
+    setLong(fp + getInt(pc + 1), getLong(sp));
+    sp += 4;
+    pc += 3;
+    NEXT();
+
+op_popbyteaddr: // pop byte [label]
+    setChar(getPtr(pc + 1), getChar(sp));
+    sp += 1;
+    pc += 3;
+    NEXT();
+
+op_popwordaddr: // pop word [label]
+    setInt(getPtr(pc + 1), getInt(sp));
+    sp += 2;
+    pc += 3;
+    NEXT();
+
+op_popdwordaddr: // pop dword [label]
+    setLong(getPtr(pc + 1), getLong(sp));
+    sp += 4;
+    pc += 3;
+    NEXT();
+
+op_popbyte:
+    setChar(getPtr(sp), getChar(sp + 2));
+    sp += 3;
+    pc += 1;
+    NEXT();
+
+op_popword:
+    setInt(getPtr(sp), getInt(sp + 2));
+    sp += 4;
+    pc += 1;
+    NEXT();
+
+op_popdword:
+    setLong(getPtr(sp), getLong(sp + 2));
+    sp += 6;
+    pc += 1;
+    NEXT();
+
+op_call:
+    sp -= 2;
+    setPtr(sp, pc + 3);
+    sp -= 2;
+    setPtr(sp, fp);
+    fp = sp;
+    pc = getPtr(pc + 1);
+    NEXT();
+
+op_ret:
+    // Returns that release a lock or resolve a future are left to executeInstruction
+    if(thread->nLocks && thread->locks[thread->nLocks - 1].fp == fp)
+        goto fallback;
+    if(argBin->future && getPtr(fp) == 0 && getPtr(fp + 2) == 0)
+        goto fallback;
+    sp = fp + getInt(pc + 1) + 4;
+    pc = getPtr(fp + 2);
+    fp = getPtr(fp);
+    // Same as in executeInstruction, a zero $fp means the bottom of a sync or async call
+    if(fp == 0)
+    {
+        SAVE();
+        if(pc == 0)
+        {
+            pushVmThread(thread);
+            freeVmArgBin(argBin);
+        }
+        return;
+    }
+    NEXT();
+
+op_addbyte: BYTEOP(+)
+op_addword: WORDOP(+)
+op_adddword: DWORDOP(+)
+op_subbyte: BYTEOP(-)
+op_subword: WORDOP(-)
+op_subdword: DWORDOP(-)
+op_mulbyte: BYTEOP(*)
+op_mulword: WORDOP(*)
+op_muldword: DWORDOP(*)
+op_divbyte: BYTEOP(/)
+op_divword: WORDOP(/)
+op_divdword: DWORDOP(/)
+op_modbyte: BYTEOP(%)
+op_modword: WORDOP(%)
+op_moddword: DWORDOP(%)
+op_andbyte: BYTEOP(&)
+op_andword: WORDOP(&)
+op_anddword: DWORDOP(&)
+op_orbyte: BYTEOP(|)
+op_orword: WORDOP(|)
+op_ordword: DWORDOP(|)
+op_xorbyte: BYTEOP(^)
+op_xorword: WORDOP(^)
+op_xordword: DWORDOP(^)
+
+op_sgzbyte: BYTETEST(> 0)
+op_sgzword: WORDTEST(> 0)
+op_sgzdword: DWORDTEST(> 0)
+op_sgezbyte: BYTETEST(>= 0)
+op_sgezword: WORDTEST(>= 0)
+op_sgezdword: DWORDTEST(>= 0)
+op_sezbyte: BYTETEST(== 0)
+op_sezword: WORDTEST(== 0)
+op_sezdword: DWORDTEST(== 0)
+op_snezbyte: BYTETEST(!= 0)
+op_snezword: WORDTEST(!= 0)
+op_snezdword: DWORDTEST(!= 0)
+
+op_jmp:
+    pc = getPtr(pc + 1);
+    NEXT();
+
+op_jez:
+    ca = getChar(sp);
+    sp += 1;
+    pc = ca == 0 ? getPtr(pc + 1) : pc + 3;
+    NEXT();
+
+op_jnez:
+    ca = getChar(sp);
+    sp += 1;
+    pc = ca != 0 ? getPtr(pc + 1) : pc + 3;
+    NEXT();
+
+op_sllbyte: SHIFT(getChar, setChar, char, <<)
+op_sllword: SHIFT(getInt, setInt, int, <<)
+op_slldword: SHIFT(getLong, setLong, long, <<)
+op_sllvbyte: SHIFTV(getChar, setChar, 1, char, <<)
+op_sllvword: SHIFTV(getInt, setInt, 2, int, <<)
+op_sllvdword: SHIFTV(getLong, setLong, 4, long, <<)
+op_srlbyte: SHIFT(getChar, setChar, unsigned char, >>)
+op_srlword: SHIFT(getInt, setInt, unsigned int, >>)
+op_srldword: SHIFT(getLong, setLong, unsigned long, >>)
+op_srlvbyte: SHIFTV(getChar, setChar, 1, unsigned char, >>)
+op_srlvword: SHIFTV(getInt, setInt, 2, unsigned int, >>)
+op_srlvdword: SHIFTV(getLong, setLong, 4, unsigned long, >>)
+op_srabyte: SHIFT(getChar, setChar, char, >>)
+op_sraword: SHIFT(getInt, setInt, int, >>)
+op_sradword: SHIFT(getLong, setLong, long, >>)
+op_sravbyte: SHIFTV(getChar, setChar, 1, char, >>)
+op_sravword: SHIFTV(getInt, setInt, 2, int, >>)
+op_sravdword: SHIFTV(getLong, setLong, 4, long, >>)
+
+op_addwordfpfp: // word [$fp+c] = [$fp+b] + [$fp+a]
+    setInt(fp + getInt(pc + 8), getInt(fp + getInt(pc + 4)) + getInt(fp + getInt(pc + 1)));
+    pc += 10;
+    NEXT();
+
+op_subwordfpfp: // word [$fp+c] = [$fp+b] - [$fp+a]
+    setInt(fp + getInt(pc + 8), getInt(fp + getInt(pc + 4)) - getInt(fp + getInt(pc + 1)));
+    pc += 10;
+    NEXT();
+
+op_addwordfpimm: // word [$fp+c] = k + [$fp+a]
+    setInt(fp + getInt(pc + 8), getInt(pc + 4) + getInt(fp + getInt(pc + 1)));
+    pc += 10;
+    NEXT();
+
+op_push2wordfp: // push word [$fp+a], push word [$fp+b]
+    sp -= 4;
+    setInt(sp + 2, getInt(fp + getInt(pc + 1)));
+    setInt(sp, getInt(fp + getInt(pc + 4)));
+    pc += 6;
+    NEXT();
+
+op_movwordfp: // word [$fp+c] = [$fp+a]
+    setInt(fp + getInt(pc + 4), getInt(fp + getInt(pc + 1)));
+    pc += 6;
+    NEXT();
+
+op_movwordimmfp: // word [$fp+c] = k
+    setInt(fp + getInt(pc + 4), getInt(pc + 1));
+    pc += 6;
+    NEXT();
+
+op_sltbyte: BYTECMP(char, <)
+op_sltword: WORDCMP(int, <)
+op_sltdword: DWORDCMP(long, <)
+op_slebyte: BYTECMP(char, <=)
+op_sleword: WORDCMP(int, <=)
+op_sledword: DWORDCMP(long, <=)
+op_seqbyte: BYTECMP(char, ==)
+op_seqword: WORDCMP(int, ==)
+op_seqdword: DWORDCMP(long, ==)
+op_snebyte: BYTECMP(char, !=)
+op_sneword: WORDCMP(int, !=)
+op_snedword: DWORDCMP(long, !=)
+op_sltubyte: BYTECMP(unsigned char, <)
+op_sltuword: WORDCMP(unsigned int, <)
+op_sltudword: DWORDCMP(unsigned long, <)
+op_sleubyte: BYTECMP(unsigned char, <=)
+op_sleuword: WORDCMP(unsigned int, <=)
+op_sleudword: DWORDCMP(unsigned long, <=)
+
+op_jltbyte: BYTEJUMP(char, <)
+op_jltword: WORDJUMP(int, <)
+op_jltdword: DWORDJUMP(long, <)
+op_jgebyte: BYTEJUMP(char, >=)
+op_jgeword: WORDJUMP(int, >=)
+op_jgedword: DWORDJUMP(long, >=)
+op_jeqbyte: BYTEJUMP(char, ==)
+op_jeqword: WORDJUMP(int, ==)
+op_jeqdword: DWORDJUMP(long, ==)
+op_jnebyte: BYTEJUMP(char, !=)
+op_jneword: WORDJUMP(int, !=)
+op_jnedword: DWORDJUMP(long, !=)
+op_jltubyte: BYTEJUMP(unsigned char, <)
+op_jltuword: WORDJUMP(unsigned int, <)
+op_jltudword: DWORDJUMP(unsigned long, <)
+op_jgeubyte: BYTEJUMP(unsigned char, >=)
+op_jgeuword: WORDJUMP(unsigned int, >=)
+op_jgeudword: DWORDJUMP(unsigned long, >=)
+
+op_addbyteimm: IMMOP(getChar, setChar, 1, +)
+op_addwordimm: IMMOP(getInt, setInt, 2, +)
+op_adddwordimm: IMMOP(getLong, setLong, 4, +)
+
+op_subbyteimm: IMMOP(getChar, setChar, 1, -)
+op_subwordimm: IMMOP(getInt, setInt, 2, -)
+op_subdwordimm: IMMOP(getLong, setLong, 4, -)
+
+op_andbyteimm: IMMOP(getChar, setChar, 1, &)
+op_andwordimm: IMMOP(getInt, setInt, 2, &)
+op_anddwordimm: IMMOP(getLong, setLong, 4, &)
+
+op_orbyteimm: IMMOP(getChar, setChar, 1, |)
+op_orwordimm: IMMOP(getInt, setInt, 2, |)
+op_ordwordimm: IMMOP(getLong, setLong, 4, |)
+
+op_xorbyteimm: IMMOP(getChar, setChar, 1, ^)
+op_xorwordimm: IMMOP(getInt, setInt, 2, ^)
+op_xordwordimm: IMMOP(getLong, setLong, 4, ^)
+
+op_mulbyteimm: IMMOP(getChar, setChar, 1, *)
+op_mulwordimm: IMMOP(getInt, setInt, 2, *)
+op_muldwordimm: IMMOP(getLong, setLong, 4, *)
+
+op_incbytefp: // byte [$fp+c] += imm
+    addr = fp + getInt(pc + 1);
+    setChar(addr, getChar(addr) + getChar(pc + 3));
+    pc += 4;
+    NEXT();
+
+op_incwordfp: // word [$fp+c] += imm
+    addr = fp + getInt(pc + 1);
+    setInt(addr, getInt(addr) + getInt(pc + 3));
+    pc += 5;
+    NEXT();
+
+op_incdwordfp: // dword [$fp+c] += imm
+    addr = fp + getInt(pc + 1);
+    setLong(addr, getLong(addr) + getLong(pc + 3));
+    pc += 7;
+    NEXT();
+
+op_pushbyteaddridx: LOADINDEXED(getChar, setChar, 1, (char*) getPtr(pc + 1))
+op_pushwordaddridx: LOADINDEXED(getInt, setInt, 2, (char*) getPtr(pc + 1))
+op_pushdwordaddridx: LOADINDEXED(getLong, setLong, 4, (char*) getPtr(pc + 1))
+op_pushbytefpidx: LOADINDEXED(getChar, setChar, 1, fp + getInt(pc + 1))
+op_pushwordfpidx: LOADINDEXED(getInt, setInt, 2, fp + getInt(pc + 1))
+op_pushdwordfpidx: LOADINDEXED(getLong, setLong, 4, fp + getInt(pc + 1))
+op_pushbytedisp: LOADDISPLACED(getChar, setChar, 1)
+op_pushworddisp: LOADDISPLACED(getInt, setInt, 2)
+op_pushdworddisp: LOADDISPLACED(getLong, setLong, 4)
+op_popbyteaddridx: STOREINDEXED(getChar, setChar, 1, (char*) getPtr(pc + 1))
+op_popwordaddridx: STOREINDEXED(getInt, setInt, 2, (char*) getPtr(pc + 1))
+op_popdwordaddridx: STOREINDEXED(getLong, setLong, 4, (char*) getPtr(pc + 1))
+op_popbytefpidx: STOREINDEXED(getChar, setChar, 1, fp + getInt(pc + 1))
+op_popwordfpidx: STOREINDEXED(getInt, setInt, 2, fp + getInt(pc + 1))
+op_popdwordfpidx: STOREINDEXED(getLong, setLong, 4, fp + getInt(pc + 1))
+op_popbytedisp: STOREDISPLACED(getChar, setChar, 1)
+op_popworddisp: STOREDISPLACED(getInt, setInt, 2)
+op_popdworddisp: STOREDISPLACED(getLong, setLong, 4)
+
+op_pushfps: // push $fp+c
+    sp -= 2;
+    setPtr(sp, fp + (signed char) getChar(pc + 1));
+    pc += 2;
+    NEXT();
+
+op_pushbytefps: // push byte [$fp+c]
+    sp -= 1;
+    setChar(sp, getChar(fp + (signed char) getChar(pc + 1)));
+    pc += 2;
+    NEXT();
+
+op_pushwordfps: // push word [$fp+c]
+    sp -= 2;
+    setInt(sp, getInt(fp + (signed char) getChar(pc + 1)));
+    pc += 2;
+    NEXT();
+
+op_pushdwordfps: // push dword [$fp+c]
+    sp -= 4;
+    setLong(sp, getLong(fp + (signed char) getChar(pc + 1)));
+    pc += 2;
+    NEXT();
+
+op_popbytefps: // pop byte [$fp+c]
+    setChar(fp + (signed char) getChar(pc + 1), getChar(sp));
+    sp += 1;
+    pc += 2;
+    NEXT();
+
+op_popwordfps: // pop word [$fp+c]
+    setInt(fp + (signed char) getChar(pc + 1), getInt(sp));
+    sp += 2;
+    pc += 2;
+    NEXT();
+
+op_popdwordfps: // pop dword [$fp+c]
+    setLong(fp + (signed char) getChar(pc + 1), getLong(sp));
+    sp += 4;
+    pc += 2;
+    NEXT();
+
+op_pushwordimms: // push word imm, sign extended from a byte
+    sp -= 2;
+    setInt(sp, (signed char) getChar(pc + 1));
+    pc += 2;
+    NEXT();
+
+op_pushdwordimms: // push dword imm, sign extended from a byte
+    sp -= 4;
+    setLong(sp, (signed char) getChar(pc + 1));
+    pc += 2;
+    NEXT();
+
+op_pushimms:
+    sp -= (unsigned char) getChar(pc + 1);
+    pc += 2;
+    NEXT();
+
+op_popimms:
+    sp += (unsigned char) getChar(pc + 1);
+    pc += 2;
+    NEXT();
+
+op_pushwordloc0: PUSHLOCAL(-2)
+op_pushwordloc1: PUSHLOCAL(-4)
+op_pushwordloc2: PUSHLOCAL(-6)
+op_pushwordloc3: PUSHLOCAL(-8)
+op_popwordloc0: POPLOCAL(-2)
+op_popwordloc1: POPLOCAL(-4)
+op_popwordloc2: POPLOCAL(-6)
+op_popwordloc3: POPLOCAL(-8)
+op_pushwordarg0: PUSHLOCAL(4)
+op_pushwordarg1: PUSHLOCAL(6)
+
+op_jmps:
+    pc += 2 + (signed char) getChar(pc + 1);
+    NEXT();
+
+op_jezs:
+    ca = getChar(sp);
+    sp += 1;
+    pc += ca == 0 ? 2 + (signed char) getChar(pc + 1) : 2;
+    NEXT();
+
+op_jnezs:
+    ca = getChar(sp);
+    sp += 1;
+    pc += ca != 0 ? 2 + (signed char) getChar(pc + 1) : 2;
+    NEXT();
+
+op_tableswitch: // jump to target [index], or to the default one
+    ia = getInt(sp);
+    sp += 2;
+    pc = (unsigned int) ia < (unsigned char) getChar(pc + 1) ? getPtr(pc + 4 + 2*ia) : getPtr(pc + 2);
+    NEXT();
+
+op_in: // push byte [c] & mask
+    sp -= 1;
+    setChar(sp, *(volatile char*) getPtr(pc + 1) & getChar(pc + 3));
+    pc += 4;
+    NEXT();
+
+op_out: // pop byte into the masked bits of [c]
+    ca = getChar(sp);
+    sp += 1;
+    cb = getChar(pc + 3);
+    ioModify(getPtr(pc + 1), cb, ca & cb);
+    pc += 4;
+    NEXT();
+
+op_sbi: // set the masked bits of [c]
+    ioModify(getPtr(pc + 1), 0, getChar(pc + 3));
+    pc += 4;
+    NEXT();
+
+op_cbi: // clear the masked bits of [c]
+    ioModify(getPtr(pc + 1), getChar(pc + 3), 0);
+    pc += 4;
+    NEXT();
+
+op_djnzwordfp: // [$fp+c] -= 1, jump if nonzero
+    addr = fp + getInt(pc + 1);
+    ia = getInt(addr) - 1;
+    setInt(addr, ia);
+    pc = ia != 0 ? getPtr(pc + 3) : pc + 5;
+    NEXT();
+
+op_tailcall:
+    SAVE();
+    tailCall(thread, getPtr(pc + 1), getChar(pc + 3), getChar(pc + 4));
+    LOAD();
+    NEXT();
+
+fallback:
+    // Calls into other objects, externs and so on are left to the switch
+    SAVE();
+    if(!executeInstruction(thread, argBin))
+        return;
+    LOAD();
+    NEXT();
+
+park:
+    SAVE();
+    parkVmThread(thread, argBin, 0);
+}
+
+#endif
+
+#if VM_DISPATCH == VM_DISPATCH_CACHED
+
+// Top of stack caching core. The topmost 1, 2 or 4 bytes of the stack live in tos, with
+// tosSize telling how many bytes that is (0 when nothing is cached). Operations on the
+// top slot then work on a register instead of going through mem, and the cache is only
+// written out to the stack (spilled) when something else needs to see the stack in
+// memory: calls, returns, pushes of a new value and everything that is handed over to
+// executeInstruction (SYNC, ASYNC, CALLE and so on)
+#define SAVE() { thread->pc = pc; thread->sp = sp; thread->fp = fp; }
+#define LOAD() { pc = thread->pc; sp = thread->sp; fp = thread->fp; }
+
+#define SPILL() if(tosSize) { \
+        sp -= tosSize; \
+        if(tosSize == 1) setChar(sp, tos); else if(tosSize == 2) setInt(sp, tos); else setLong(sp, tos); \
+        tosSize = 0; }
+
+// Makes sure the cache holds the topmost size bytes of the stack
+#define FILL(get, size) if(tosSize != size) { SPILL(); tos = get(sp); sp += size; tosSize = size; }
+
+#define PUSH(value, size) { SPILL(); tos = value; tosSize = size; }
+#define POP(set, get, addr, size) { FILL(get, size); set(addr, tos); tosSize = 0; }
+
+#define BINARY(type, get, size, op) { FILL(get, size); tos = (type) tos op (type) get(sp); sp += size; pc += 1; }
+#define TEST(type, get, size, cond) { FILL(get, size); tos = (type) tos cond; tosSize = 1; pc += 1; }
+#define COMPARE(type, get, size, op) { FILL(get, size); tos = (type) tos op (type) get(sp); sp += size; tosSize = 1; pc += 1; }
+#define JUMP(type, get, size, op) { FILL(get, size); tosSize = 0; ia = (type) tos op (type) get(sp); sp += size; \
+        pc = ia ? getPtr(pc + 1) : pc + 3; }
+#define IMMEDIATE(type, get, size, op) { FILL(get, size); tos = (type) tos op (type) get(pc + 1); pc += 1 + size; }
+// Indexed and displaced accesses, the index or pointer is what gets cached
+#define LOADINDEXED(get, size, base) { FILL(getInt, 2); addr = base + (int) tos * (unsigned char) getChar(pc + 3); \
+        tos = get(addr); tosSize = size; pc += 4; }
+#define STOREINDEXED(get, set, size, base) { FILL(getInt, 2); tosSize = 0; \
+        addr = base + (int) tos * (unsigned char) getChar(pc + 3); set(addr, get(sp)); sp += size; pc += 4; }
+#define LOADDISPLACED(get, size) { FILL(getInt, 2); addr = (char*) (int) tos + getInt(pc + 1); \
+        tos = get(addr); tosSize = size; pc += 3; }
+#define STOREDISPLACED(get, set, size) { FILL(getInt, 2); tosSize = 0; \
+        addr = (char*) (int) tos + getInt(pc + 1); set(addr, get(sp)); sp += size; pc += 3; }
+#define SHIFT(type, get, size, op) { FILL(get, size); tos = (type) tos op getChar(pc + 1); pc += 2; }
+#define SHIFTV(type, get, size, op) { FILL(get, size); ca = getChar(sp); sp += 1; tos = (type) tos op ca; pc += 1; }
+
+void runCached(VmThread* thread, VmArgBin* argBin)
+{
+    char* pc;
+    char* sp;
+    char* fp;
+    void* addr;
+    char ca;
+    int ia;
+    long tos = 0;
+    char tosSize = 0;
+#if VM_QUANTUM > 0
+    unsigned int budget = VM_QUANTUM;
+#endif
+
+    LOAD();
+    for(;;)
+    {
+        COUNT_INSTRUCTION(pc);
+        if(QUANTUM_EXPIRED())
+        {
+            SPILL();
+            SAVE();
+            parkVmThread(thread, argBin, 0);
+            return;
+        }
+        switch((unsigned char) getChar(pc))
+        {
+        case OP_PUSHFP: PUSH((int) (fp + getInt(pc + 1)), 2); pc += 3; break;
+        case OP_PUSHADDR:
+        case OP_PUSHWORDIMM: PUSH(getInt(pc + 1), 2); pc += 3; break;
+        case OP_PUSHBYTEIMM: PUSH(getChar(pc + 1), 1); pc += 2; break;
+        case OP_PUSHDWORDIMM: PUSH(getLong(pc + 1), 4); pc += 5; break;
+        case OP_PUSHBYTEFP: PUSH(getChar(fp + getInt(pc + 1)), 1); pc += 3; break;
+        case OP_PUSHWORDFP: PUSH(getInt(fp + getInt(pc + 1)), 2); pc += 3; break;
+        case OP_PUSHDWORDFP: PUSH(getLong(fp + getInt(pc + 1)), 4); pc += 3; break;
+        case OP_PUSHBYTEADDR: PUSH(getChar(getPtr(pc + 1)), 1); pc += 3; break;
+        case OP_PUSHWORDADDR: PUSH(getInt(getPtr(pc + 1)), 2); pc += 3; break;
+        case OP_PUSHDWORDADDR: PUSH(getLong(getPtr(pc + 1)), 4); pc += 3; break;
+
+        // Replace the address on top with what it points to
+        case OP_PUSHBYTE: FILL(getInt, 2); tos = getChar((void*) (int) tos); tosSize = 1; pc += 1; break;
+        case OP_PUSHWORD: FILL(getInt, 2); tos = getInt((void*) (int) tos); pc += 1; break;
+        case OP_PUSHDWORD: FILL(getInt, 2); tos = getLong((void*) (int) tos); tosSize = 4; pc += 1; break;
+
+        case OP_POPBYTEFP: POP(setChar, getChar, fp + getInt(pc + 1), 1); pc += 3; break;
+        case OP_POPWORDFP: POP(setInt, getInt, fp + getInt(pc + 1), 2); pc += 3; break;
+        case OP_POPDWORDFP: POP(setLong, getLong, fp + getInt(pc + 1), 4); pc += 3; break;
+        case OP_POPBYTEADDR: POP(setChar, getChar, getPtr(pc + 1), 1); pc += 3; break;
+        case OP_POPWORDADDR: POP(setInt, getInt, getPtr(pc + 1), 2); pc += 3; break;
+        case OP_POPDWORDADDR: POP(setLong, getLong, getPtr(pc + 1), 4); pc += 3; break;
+
+        // Store through the address on top, the value is right below it
+        case OP_POPBYTE: FILL(getInt, 2); tosSize = 0; setChar((void*) (int) tos, getChar(sp)); sp += 1; pc += 1; break;
+        case OP_POPWORD: FILL(getInt, 2); tosSize = 0; setInt((void*) (int) tos, getInt(sp)); sp += 2; pc += 1; break;
+        case OP_POPDWORD: FILL(getInt, 2); tosSize = 0; setLong((void*) (int) tos, getLong(sp)); sp += 4; pc += 1; break;
+
+        case OP_PUSHIMM: SPILL(); sp -= getInt(pc + 1); pc += 3; break;
+        case OP_POPIMM: SPILL(); sp += getInt(pc + 1); pc += 3; break;
+
+        case OP_CALL:
+            SPILL();
+            sp -= 2;
+            setPtr(sp, pc + 3);
+            sp -= 2;
+            setPtr(sp, fp);
+            fp = sp;
+            pc = getPtr(pc + 1);
+            break;
+
+        case OP_RET:
+            SPILL();
+            SAVE();
+            if(!executeInstruction(thread, argBin))
+                return;
+            LOAD();
+            break;
+
+        case OP_ADDBYTE: BINARY(char, getChar, 1, +); break;
+        case OP_ADDWORD: BINARY(int, getInt, 2, +); break;
+        case OP_ADDDWORD: BINARY(long, getLong, 4, +); break;
+
+        case OP_SUBBYTE: BINARY(char, getChar, 1, -); break;
+        case OP_SUBWORD: BINARY(int, getInt, 2, -); break;
+        case OP_SUBDWORD: BINARY(long, getLong, 4, -); break;
+
+        case OP_MULBYTE: BINARY(char, getChar, 1, *); break;
+        case OP_MULWORD: BINARY(int, getInt, 2, *); break;
+        case OP_MULDWORD: BINARY(long, getLong, 4, *); break;
+
+        case OP_DIVBYTE: BINARY(char, getChar, 1, /); break;
+        case OP_DIVWORD: BINARY(int, getInt, 2, /); break;
+        case OP_DIVDWORD: BINARY(long, getLong, 4, /); break;
+
+        case OP_MODBYTE: BINARY(char, getChar, 1, %); break;
+        case OP_MODWORD: BINARY(int, getInt, 2, %); break;
+        case OP_MODDWORD: BINARY(long, getLong, 4, %); break;
+
+        case OP_ANDBYTE: BINARY(char, getChar, 1, &); break;
+        case OP_ANDWORD: BINARY(int, getInt, 2, &); break;
+        case OP_ANDDWORD: BINARY(long, getLong, 4, &); break;
+
+        case OP_ORBYTE: BINARY(char, getChar, 1, |); break;
+        case OP_ORWORD: BINARY(int, getInt, 2, |); break;
+        case OP_ORDWORD: BINARY(long, getLong, 4, |); break;
+
+        case OP_XORBYTE: BINARY(char, getChar, 1, ^); break;
+        case OP_XORWORD: BINARY(int, getInt, 2, ^); break;
+        case OP_XORDWORD: BINARY(long, getLong, 4, ^); break;
+
+        case OP_SGZBYTE: TEST(char, getChar, 1, > 0); break;
+        case OP_SGZWORD: TEST(int, getInt, 2, > 0); break;
+        case OP_SGZDWORD: TEST(long, getLong, 4, > 0); break;
+
+        case OP_SGEZBYTE: TEST(char, getChar, 1, >= 0); break;
+        case OP_SGEZWORD: TEST(int, getInt, 2, >= 0); break;
+        case OP_SGEZDWORD: TEST(long, getLong, 4, >= 0); break;
+
+        case OP_SEZBYTE: TEST(char, getChar, 1, == 0); break;
+        case OP_SEZWORD: TEST(int, getInt, 2, == 0); break;
+        case OP_SEZDWORD: TEST(long, getLong, 4, == 0); break;
+
+        case OP_SNEZBYTE: TEST(char, getChar, 1, != 0); break;
+        case OP_SNEZWORD: TEST(int, getInt, 2, != 0); break;
+        case OP_SNEZDWORD: TEST(long, getLong, 4, != 0); break;
+
+        case OP_SLTBYTE: COMPARE(char, getChar, 1, <); break;
+        case OP_SLTWORD: COMPARE(int, getInt, 2, <); break;
+        case OP_SLTDWORD: COMPARE(long, getLong, 4, <); break;
+
+        case OP_SLEBYTE: COMPARE(char, getChar, 1, <=); break;
+        case OP_SLEWORD: COMPARE(int, getInt, 2, <=); break;
+        case OP_SLEDWORD: COMPARE(long, getLong, 4, <=); break;
+
+        case OP_SEQBYTE: COMPARE(char, getChar, 1, ==); break;
+        case OP_SEQWORD: COMPARE(int, getInt, 2, ==); break;
+        case OP_SEQDWORD: COMPARE(long, getLong, 4, ==); break;
+
+        case OP_SNEBYTE: COMPARE(char, getChar, 1, !=); break;
+        case OP_SNEWORD: COMPARE(int, getInt, 2, !=); break;
+        case OP_SNEDWORD: COMPARE(long, getLong, 4, !=); break;
+
+        case OP_SLTUBYTE: COMPARE(unsigned char, getChar, 1, <); break;
+        case OP_SLTUWORD: COMPARE(unsigned int, getInt, 2, <); break;
+        case OP_SLTUDWORD: COMPARE(unsigned long, getLong, 4, <); break;
+
+        case OP_SLEUBYTE: COMPARE(unsigned char, getChar, 1, <=); break;
+        case OP_SLEUWORD: COMPARE(unsigned int, getInt, 2, <=); break;
+        case OP_SLEUDWORD: COMPARE(unsigned long, getLong, 4, <=); break;
+
+        case OP_JLTBYTE: JUMP(char, getChar, 1, <); break;
+        case OP_JLTWORD: JUMP(int, getInt, 2, <); break;
+        case OP_JLTDWORD: JUMP(long, getLong, 4, <); break;
+
+        case OP_JGEBYTE: JUMP(char, getChar, 1, >=); break;
+        case OP_JGEWORD: JUMP(int, getInt, 2, >=); break;
+        case OP_JGEDWORD: JUMP(long, getLong, 4, >=); break;
+
+        case OP_JEQBYTE: JUMP(char, getChar, 1, ==); break;
+        case OP_JEQWORD: JUMP(int, getInt, 2, ==); break;
+        case OP_JEQDWORD: JUMP(long, getLong, 4, ==); break;
+
+        case OP_JNEBYTE: JUMP(char, getChar, 1, !=); break;
+        case OP_JNEWORD: JUMP(int, getInt, 2, !=); break;
+        case OP_JNEDWORD: JUMP(long, getLong, 4, !=); break;
+
+        case OP_JLTUBYTE: JUMP(unsigned char, getChar, 1, <); break;
+        case OP_JLTUWORD: JUMP(unsigned int, getInt, 2, <); break;
+        case OP_JLTUDWORD: JUMP(unsigned long, getLong, 4, <); break;
+
+        case OP_JGEUBYTE: JUMP(unsigned char, getChar, 1, >=); break;
+        case OP_JGEUWORD: JUMP(unsigned int, getInt, 2, >=); break;
+        case OP_JGEUDWORD: JUMP(unsigned long, getLong, 4, >=); break;
+
+        case OP_SLLBYTE: SHIFT(char, getChar, 1, <<); break;
+        case OP_SLLWORD: SHIFT(int, getInt, 2, <<); break;
+        case OP_SLLDWORD: SHIFT(long, getLong, 4, <<); break;
+        case OP_SLLVBYTE: SHIFTV(char, getChar, 1, <<); break;
+        case OP_SLLVWORD: SHIFTV(int, getInt, 2, <<); break;
+        case OP_SLLVDWORD: SHIFTV(long, getLong, 4, <<); break;
+
+        case OP_SRLBYTE: SHIFT(unsigned char, getChar, 1, >>); break;
+        case OP_SRLWORD: SHIFT(unsigned int, getInt, 2, >>); break;
+        case OP_SRLDWORD: SHIFT(unsigned long, getLong, 4, >>); break;
+        case OP_SRLVBYTE: SHIFTV(unsigned char, getChar, 1, >>); break;
+        case OP_SRLVWORD: SHIFTV(unsigned int, getInt, 2, >>); break;
+        case OP_SRLVDWORD: SHIFTV(unsigned long, getLong, 4, >>); break;
+
+        case OP_SRABYTE: SHIFT(char, getChar, 1, >>); break;
+        case OP_SRAWORD: SHIFT(int, getInt, 2, >>); break;
+        case OP_SRADWORD: SHIFT(long, getLong, 4, >>); break;
+        case OP_SRAVBYTE: SHIFTV(char, getChar, 1, >>); break;
+        case OP_SRAVWORD: SHIFTV(int, getInt, 2, >>); break;
+        case OP_SRAVDWORD: SHIFTV(long, getLong, 4, >>); break;
+
+        case OP_ADDBYTEIMM: IMMEDIATE(char, getChar, 1, +); break;
+        case OP_ADDWORDIMM: IMMEDIATE(int, getInt, 2, +); break;
+        case OP_ADDDWORDIMM: IMMEDIATE(long, getLong, 4, +); break;
+
+        case OP_SUBBYTEIMM: IMMEDIATE(char, getChar, 1, -); break;
+        case OP_SUBWORDIMM: IMMEDIATE(int, getInt, 2, -); break;
+        case OP_SUBDWORDIMM: IMMEDIATE(long, getLong, 4, -); break;
+
+        case OP_ANDBYTEIMM: IMMEDIATE(char, getChar, 1, &); break;
+        case OP_ANDWORDIMM: IMMEDIATE(int, getInt, 2, &); break;
+        case OP_ANDDWORDIMM: IMMEDIATE(long, getLong, 4, &); break;
+
+        case OP_ORBYTEIMM: IMMEDIATE(char, getChar, 1, |); break;
+        case OP_ORWORDIMM: IMMEDIATE(int, getInt, 2, |); break;
+        case OP_ORDWORDIMM: IMMEDIATE(long, getLong, 4, |); break;
+
+        case OP_XORBYTEIMM: IMMEDIATE(char, getChar, 1, ^); break;
+        case OP_XORWORDIMM: IMMEDIATE(int, getInt, 2, ^); break;
+        case OP_XORDWORDIMM: IMMEDIATE(long, getLong, 4, ^); break;
+
+        case OP_MULBYTEIMM: IMMEDIATE(char, getChar, 1, *); break;
+        case OP_MULWORDIMM: IMMEDIATE(int, getInt, 2, *); break;
+        case OP_MULDWORDIMM: IMMEDIATE(long, getLong, 4, *); break;
+
+        case OP_INCBYTEFP:
+            addr = fp + getInt(pc + 1);
+            setChar(addr, getChar(addr) + getChar(pc + 3));
+            pc += 4;
+            break;
+
+        case OP_INCWORDFP:
+            addr = fp + getInt(pc + 1);
+            setInt(addr, getInt(addr) + getInt(pc + 3));
+            pc += 5;
+            break;
+
+        case OP_INCDWORDFP:
+            addr = fp + getInt(pc + 1);
+            setLong(addr, getLong(addr) + getLong(pc + 3));
+            pc += 7;
+            break;
+
+        case OP_PUSHBYTEADDRIDX: LOADINDEXED(getChar, 1, (char*) getPtr(pc + 1)); break;
+        case OP_PUSHWORDADDRIDX: LOADINDEXED(getInt, 2, (char*) getPtr(pc + 1)); break;
+        case OP_PUSHDWORDADDRIDX: LOADINDEXED(getLong, 4, (char*) getPtr(pc + 1)); break;
+        case OP_PUSHBYTEFPIDX: LOADINDEXED(getChar, 1, fp + getInt(pc + 1)); break;
+        case OP_PUSHWORDFPIDX: LOADINDEXED(getInt, 2, fp + getInt(pc + 1)); break;
+        case OP_PUSHDWORDFPIDX: LOADINDEXED(getLong, 4, fp + getInt(pc + 1)); break;
+        case OP_PUSHBYTEDISP: LOADDISPLACED(getChar, 1); break;
+        case OP_PUSHWORDDISP: LOADDISPLACED(getInt, 2); break;
+        case OP_PUSHDWORDDISP: LOADDISPLACED(getLong, 4); break;
+        case OP_POPBYTEADDRIDX: STOREINDEXED(getChar, setChar, 1, (char*) getPtr(pc + 1)); break;
+        case OP_POPWORDADDRIDX: STOREINDEXED(getInt, setInt, 2, (char*) getPtr(pc + 1)); break;
+        case OP_POPDWORDADDRIDX: STOREINDEXED(getLong, setLong, 4, (char*) getPtr(pc + 1)); break;
+        case OP_POPBYTEFPIDX: STOREINDEXED(getChar, setChar, 1, fp + getInt(pc + 1)); break;
+        case OP_POPWORDFPIDX: STOREINDEXED(getInt, setInt, 2, fp + getInt(pc + 1)); break;
+        case OP_POPDWORDFPIDX: STOREINDEXED(getLong, setLong, 4, fp + getInt(pc + 1)); break;
+        case OP_POPBYTEDISP: STOREDISPLACED(getChar, setChar, 1); break;
+        case OP_POPWORDDISP: STOREDISPLACED(getInt, setInt, 2); break;
+        case OP_POPDWORDDISP: STOREDISPLACED(getLong, setLong, 4); break;
+
+        case OP_PUSHFPS: PUSH((int) (fp + (signed char) getChar(pc + 1)), 2); pc += 2; break;
+        case OP_PUSHBYTEFPS: PUSH(getChar(fp + (signed char) getChar(pc + 1)), 1); pc += 2; break;
+        case OP_PUSHWORDFPS: PUSH(getInt(fp + (signed char) getChar(pc + 1)), 2); pc += 2; break;
+        case OP_PUSHDWORDFPS: PUSH(getLong(fp + (signed char) getChar(pc + 1)), 4); pc += 2; break;
+        case OP_POPBYTEFPS: POP(setChar, getChar, fp + (signed char) getChar(pc + 1), 1); pc += 2; break;
+        case OP_POPWORDFPS: POP(setInt, getInt, fp + (signed char) getChar(pc + 1), 2); pc += 2; break;
+        case OP_POPDWORDFPS: POP(setLong, getLong, fp + (signed char) getChar(pc + 1), 4); pc += 2; break;
+        case OP_PUSHWORDIMMS: PUSH((signed char) getChar(pc + 1), 2); pc += 2; break;
+        case OP_PUSHDWORDIMMS: PUSH((signed char) getChar(pc + 1), 4); pc += 2; break;
+        case OP_PUSHIMMS: SPILL(); sp -= (unsigned char) getChar(pc + 1); pc += 2; break;
+        case OP_POPIMMS: SPILL(); sp += (unsigned char) getChar(pc + 1); pc += 2; break;
+
+        case OP_PUSHWORDLOC0: PUSH(getInt(fp - 2), 2); pc += 1; break;
+        case OP_PUSHWORDLOC1: PUSH(getInt(fp - 4), 2); pc += 1; break;
+        case OP_PUSHWORDLOC2: PUSH(getInt(fp - 6), 2); pc += 1; break;
+        case OP_PUSHWORDLOC3: PUSH(getInt(fp - 8), 2); pc += 1; break;
+        case OP_POPWORDLOC0: POP(setInt, getInt, fp - 2, 2); pc += 1; break;
+        case OP_POPWORDLOC1: POP(setInt, getInt, fp - 4, 2); pc += 1; break;
+        case OP_POPWORDLOC2: POP(setInt, getInt, fp - 6, 2); pc += 1; break;
+        case OP_POPWORDLOC3: POP(setInt, getInt, fp - 8, 2); pc += 1; break;
+        case OP_PUSHWORDARG0: PUSH(getInt(fp + 4), 2); pc += 1; break;
+        case OP_PUSHWORDARG1: PUSH(getInt(fp + 6), 2); pc += 1; break;
+
+        case OP_JMPS: pc += 2 + (signed char) getChar(pc + 1); break;
+        case OP_JEZS: FILL(getChar, 1); tosSize = 0; pc += (char) tos == 0 ? 2 + (signed char) getChar(pc + 1) : 2; break;
+        case OP_JNEZS: FILL(getChar, 1); tosSize = 0; pc += (char) tos != 0 ? 2 + (signed char) getChar(pc + 1) : 2; break;
+
+        case OP_TABLESWITCH:
+            FILL(getInt, 2);
+            tosSize = 0;
+            ia = tos;
+            pc = (unsigned int) ia < (unsigned char) getChar(pc + 1) ? getPtr(pc + 4 + 2*ia) : getPtr(pc + 2);
+            break;
+
+        case OP_IN: PUSH(*(volatile char*) getPtr(pc + 1) & getChar(pc + 3), 1); pc += 4; break;
+        case OP_OUT:
+            FILL(getChar, 1);
+            tosSize = 0;
+            ca = getChar(pc + 3);
+            ioModify(getPtr(pc + 1), ca, (char) tos & ca);
+            pc += 4;
+            break;
+        case OP_SBI: ioModify(getPtr(pc + 1), 0, getChar(pc + 3)); pc += 4; break;
+        case OP_CBI: ioModify(getPtr(pc + 1), getChar(pc + 3), 0); pc += 4; break;
+
+        case OP_DJNZWORDFP:
+            // Only touches the frame, so the cache stays
+            addr = fp + getInt(pc + 1);
+            ia = getInt(addr) - 1;
+            setInt(addr, ia);
+            pc = ia != 0 ? getPtr(pc + 3) : pc + 5;
+            break;
+
+        case OP_TAILCALL:
+            SPILL();
+            SAVE();
+            tailCall(thread, getPtr(pc + 1), getChar(pc + 3), getChar(pc + 4));
+            LOAD();
+            break;
+
+        case OP_JMP: pc = getPtr(pc + 1); break;
+        case OP_JEZ: FILL(getChar, 1); tosSize = 0; pc = (char) tos == 0 ? getPtr(pc + 1) : pc + 3; break;
+        case OP_JNEZ: FILL(getChar, 1); tosSize = 0; pc = (char) tos != 0 ? getPtr(pc + 1) : pc + 3; break;
+
+        // The three-address superinstructions never touch the stack, so the cache stays
+        case OP_ADDWORDFPFP:
+            setInt(fp + getInt(pc + 8), getInt(fp + getInt(pc + 4)) + getInt(fp + getInt(pc + 1)));
+            pc += 10;
+            break;
+
+        case OP_SUBWORDFPFP:
+            setInt(fp + getInt(pc + 8), getInt(fp + getInt(pc + 4)) - getInt(fp + getInt(pc + 1)));
+            pc += 10;
+            break;
+
+        case OP_ADDWORDFPIMM:
+            setInt(fp + getInt(pc + 8), getInt(pc + 4) + getInt(fp + getInt(pc + 1)));
+            pc += 10;
+            break;
+
+        case OP_MOVWORDFP:
+            setInt(fp + getInt(pc + 4), getInt(fp + getInt(pc + 1)));
+            pc += 6;
+            break;
+
+        case OP_MOVWORDIMMFP:
+            setInt(fp + getInt(pc + 4), getInt(pc + 1));
+            pc += 6;
+            break;
+
+        case OP_PUSH2WORDFP:
+            SPILL();
+            sp -= 2;
+            setInt(sp, getInt(fp + getInt(pc + 1)));
+            tos = getInt(fp + getInt(pc + 4));
+            tosSize = 2;
+            pc += 6;
+            break;
+
+        default:
+            // Everything else sees the stack in memory
+            SPILL();
+            SAVE();
+            if(!executeInstruction(thread, argBin))
+                return;
+            LOAD();
+            break;
+        }
+    }
+}
+
+#endif
+
+#ifdef VM_COUNT_CYCLES
+
+static void countedExec(Object* obj, int arg);
+
+// An exec() can start within the interval of an opcode of another one, from a SYNC or by
+// preempting it. It times its own opcodes from scratch, and the interval it came into
+// goes on afterwards without the cycles it took
+void exec(Object* obj, int arg)
+{
+    unsigned char outerClass = lastClass;
+    unsigned int outerCycle = lastCycle;
+    unsigned int start = TCNT3;
+    lastClass = VM_NCLASSES;
+    countedExec(obj, arg);
+    lastClass = outerClass;
+    lastCycle = outerCycle + (unsigned int) (TCNT3 - start);
+}
+
+static void countedExec(Object* obj, int arg)
+#else
+void exec(Object* obj, int arg)
+#endif
+{
+    VmArgBin* argBin = (VmArgBin*) arg;
+    VmThread* thread;
+    
+    // If a thread was provided, this is a sync call or a parked thread continuing
+    if(argBin->thread)
+    {
+        thread = argBin->thread;
+        thread->pc = argBin->methodAddr;
+        thread->obj = obj;
+    }
+    else
+    {
+        // Fetch a new thread object and populate it with the stack contents. If all
+        // threads or all of memory is in use, wait until some has been returned
+        thread = popVmThreadOrWait(obj, argBin);
+        if(!thread)
+            return;
+        pushArray(thread, argBin->argStack, argBin->argSize);
+        pushInt(thread, 0); // fake return address
+        pushInt(thread, 0); // fake old frame pointer
+        thread->fp = thread->sp;
+        thread->pc = argBin->methodAddr;
+        thread->obj = obj;
+    }
+    
+#if VM_DISPATCH == VM_DISPATCH_THREADED
+    runThreaded(thread, argBin);
+#elif VM_DISPATCH == VM_DISPATCH_CACHED
+    runCached(thread, argBin);
+#else
+#if VM_QUANTUM > 0
+    unsigned int budget = VM_QUANTUM;
+#endif
+    do
+    {
+        COUNT_INSTRUCTION(thread->pc);
+        if(QUANTUM_EXPIRED())
+        {
+            parkVmThread(thread, argBin, 0);
+            return;
+        }
+    }
     while(executeInstruction(thread, argBin));
+#endif
 }
\ No newline at end of file
@@ -4,118 +4,66 @@
 #define VM_MAX_ARGSIZE 64
 #define VM_STACKSIZE 256
 
-#define VM_NARGBINS 8
-#define VM_NTHREADS 4
+#define VM_ARGARENA_SIZE 256 // Bytes for the arguments of pending messages, see allocVmArgBin()
+#define VM_NTHREADS 8 // Running and waiting activities, stack memory is the tighter limit
+#define VM_NSHARES 4  // Stacks memory is split into when the verifier can't bound their depth
+#define VM_LOCKDEPTH 4
 
 #define VM_MEMORY_SIZE 3500
 
+// Interpreter cores, selected at build time through VM_DISPATCH
+#define VM_DISPATCH_SWITCH 0   // executeInstruction() once per opcode
+#define VM_DISPATCH_THREADED 1 // computed goto dispatch, needs GCC
+#define VM_DISPATCH_CACHED 2   // top of stack kept in registers
+
+#ifndef VM_DISPATCH
+#define VM_DISPATCH VM_DISPATCH_SWITCH
+#endif
+
+// Define VM_COUNT_INSTRUCTIONS to have exec() count every executed opcode in
+// vmInstructionCount, which is what we compare the interpreter cores with
+//
+// Define VM_COUNT_CYCLES instead to have exec() count the opcodes of every class below in
+// vmClassCount and the CPU cycles they take in vmClassCycles, timed with timer 3 (which
+// TinyTimber leaves alone) from one dispatch to the next. Building a benchmark program
+// with each VM_DISPATCH and reading the arrays (over a debugger, or from simavr) gives
+// cycles per opcode class for each core. The cycles include the dispatch and a constant
+// few for the timing itself. Opcodes that leave exec(), like the final RET and those that
+// park, aren't counted. The exec() of a SYNC or of a preempting message is left out of
+// the opcode it interrupts, but interrupt handlers are not
+#define VM_CLASS_STACK 0   // Pushes, pops, and loads and stores through frame and address
+#define VM_CLASS_ARITH 1   // Arithmetic, logic and shifts
+#define VM_CLASS_COMPARE 2 // Set on condition
+#define VM_CLASS_JUMP 3    // Jumps, branches and TABLESWITCH
+#define VM_CLASS_CALL 4    // CALL, RET and TAILCALL
+#define VM_CLASS_MESSAGE 5 // ASYNC, suspension, channels and futures
+#define VM_CLASS_EXTERN 6  // CALLE and I/O
+#define VM_CLASS_OTHER 7
+#define VM_NCLASSES 8
+
+// Instruction budget of an exec. When it runs out the thread is parked and the rest of
+// the method is sent to the same object again, with the same baseline and deadline, so
+// that tighter deadlines get a chance in between. The method then no longer runs as one
+// atomic reaction of its object, hence 0 (no budget) is the default. Threads that can't
+// be parked (see CAN_PARK in vm.c) just carry on
+#ifndef VM_QUANTUM
+#define VM_QUANTUM 0
+#endif
+
 #include <avr/pgmspace.h>
+#include <stdbool.h>
 #include "TinyTimber.h"
+#include "vmops.h"
 
 extern const PROGMEM unsigned char instructionLength[];
 
-#define OP_PUSHFP 0x01
-#define OP_PUSHIMM 0x02
-#define OP_PUSHADDR 0x03
-#define OP_PUSHBYTEFP 0x04
-#define OP_PUSHWORDFP 0x05
-#define OP_PUSHDWORDFP 0x06
-#define OP_PUSHBYTEADDR 0x07
-#define OP_PUSHWORDADDR 0x08
-#define OP_PUSHDWORDADDR 0x09
-#define OP_PUSHBYTEIMM 0x0A
-#define OP_PUSHWORDIMM 0x0B
-#define OP_PUSHDWORDIMM 0x0C
-#define OP_PUSHBYTE 0x0D
-#define OP_PUSHWORD 0x0E
-#define OP_PUSHDWORD 0x0F
-#define OP_POPIMM 0x10
-#define OP_POPBYTEFP 0x11
-#define OP_POPWORDFP 0x12
-#define OP_POPDWORDFP 0x13
-#define OP_POPBYTEADDR 0x14
-#define OP_POPWORDADDR 0x15
-#define OP_POPDWORDADDR 0x16
-#define OP_POPBYTE 0x17
-#define OP_POPWORD 0x18
-#define OP_POPDWORD 0x19
-#define OP_CALL 0x1A
-#define OP_RET 0x1B
-#define OP_SYNC 0x1C
-#define OP_ASYNC 0x1D
-#define OP_CALLE 0x1E
-#define OP_ADDBYTE 0x1F
-#define OP_ADDWORD 0x20
-#define OP_ADDDWORD 0x21
-#define OP_SUBBYTE 0x22
-#define OP_SUBWORD 0x23
-#define OP_SUBDWORD 0x24
-#define OP_MULBYTE 0x25
-#define OP_MULWORD 0x26
-#define OP_MULDWORD 0x27
-#define OP_DIVBYTE 0x28
-#define OP_DIVWORD 0x29
-#define OP_DIVDWORD 0x2A
-#define OP_MODBYTE 0x2B
-#define OP_MODWORD 0x2C
-#define OP_MODDWORD 0x2D
-    
-#define OP_ANDBYTE 0x2E
-#define OP_ANDWORD 0x2F
-#define OP_ANDDWORD 0x30
-    
-#define OP_ORBYTE 0x31
-#define OP_ORWORD 0x32
-#define OP_ORDWORD 0x33
-    
-#define OP_XORBYTE 0x34
-#define OP_XORWORD 0x35
-#define OP_XORDWORD 0x36
-    
-#define OP_SGZBYTE 0x37
-#define OP_SGZWORD 0x38
-#define OP_SGZDWORD 0x39
-
-#define OP_SGEZBYTE 0x3A
-#define OP_SGEZWORD 0x3B
-#define OP_SGEZDWORD 0x3C
-           
-#define OP_SEZBYTE 0x3D
-#define OP_SEZWORD 0x3E
-#define OP_SEZDWORD 0x3F
-           
-#define OP_SNEZBYTE 0x40
-#define OP_SNEZWORD 0x41
-#define OP_SNEZDWORD 0x42
-    
-#define OP_JMP 0x43
-
-#define OP_JEZ 0x44
-#define OP_JNEZ 0x45
-
-#define OP_SLLBYTE 0x46
-#define OP_SLLWORD 0x47
-#define OP_SLLDWORD 0x48
-
-#define OP_SLLVBYTE 0x49
-#define OP_SLLVWORD 0x4A
-#define OP_SLLVDWORD 0x4B
-
-#define OP_SRLBYTE 0x4C
-#define OP_SRLWORD 0x4D
-#define OP_SRLDWORD 0x4E
-
-#define OP_SRLVBYTE 0x4F
-#define OP_SRLVWORD 0x50
-#define OP_SRLVDWORD 0x51
-
-#define OP_SRABYTE 0x52
-#define OP_SRAWORD 0x53
-#define OP_SRADWORD 0x54
-
-#define OP_SRAVBYTE 0x55
-#define OP_SRAVWORD 0x56
-#define OP_SRAVDWORD 0x57
+// A SYNC that runs in the interpreter loop of the caller, see OP_SYNC
+typedef struct
+{
+    Object* obj;     // Object we locked, 0 if we held it already
+    Object* prevObj; // Object the caller runs in
+    char* fp;        // Frame of the called method
+} VmLock;
 
 typedef struct VmThread
 {
@@ -124,19 +72,144 @@ typedef struct VmThread
     char* pc;
     char* stack;
     char* bottom;
+    char syncDepth; // Number of SYNC calls with exec on the C stack we're inside of
+    Object* obj;    // Object we're currently running in
+    VmLock locks[VM_LOCKDEPTH];
+    unsigned char nLocks;
+    unsigned char heldLocks; // Number of locks that we took ourselves
     struct VmThread* next;
 }  VmThread;
 
+// A pending message to exec and its arguments, which get as much room as their size class
 typedef struct VmArgBin
 {
-    int argSize;
-    char argStack[VM_MAX_ARGSIZE];
     struct VmArgBin* next;
     VmThread* thread;
     char* returnAddr;
     char* methodAddr;
+    char* future; // Where the final RET of an ASYNCF call stores its result
+    Object* obj;  // Receiver, while the message waits for a thread or stack to start on
+    unsigned char argSize;
+    unsigned char sizeClass;
+    char argStack[];
 } VmArgBin;
 
+// Native function callable from VM programs through OP_CALLE. It gets the object of its
+// descriptor and a pointer to its arguments, which lie in VM memory in the order they are
+// declared in so that a struct of them can be laid over them
+typedef long (*VmExternFn)(Object* self, void* args);
+
+#define VM_EXTERN_LOCKED 1 // Needs the object locked, through SYNC if it is busy
+
+typedef struct
+{
+    VmExternFn fn;
+    Object* obj;
+    unsigned char argSize; // Bytes of arguments, popped by OP_CALLE
+    unsigned char retSize; // Bytes of the return value pushed by OP_CALLE (0, 1, 2 or 4)
+    unsigned char flags;
+} VmExtern;
+
+// Extern IDs, which images can call externs by (OP_CALLE with the ID as operand). They
+// are also the indices in vmExterns. Don't renumber them, new ones go last
+enum
+{
+    VM_EXTERN_MEMCPY,
+    VM_EXTERN_MEMSET,
+    VM_EXTERN_MEMCMP,
+    VM_EXTERN_MEMCHR,
+    VM_EXTERN_MACQ15,
+    VM_EXTERN_MACQ7,
+    VM_EXTERN_FIRQ15,
+    VM_EXTERN_SUM,
+    VM_EXTERN_MIN,
+    VM_EXTERN_MAX,
+    VM_EXTERN_MEAN,
+    VM_EXTERN_SCALE,
+    VM_EXTERN_TOGGLELED,
+    VM_EXTERN_SETLED,
+    VM_EXTERN_SETUARTCALLBACK,
+    VM_EXTERN_UARTTRANSMIT,
+    VM_EXTERN_POOLCREATE,
+    VM_EXTERN_POOLALLOC,
+    VM_EXTERN_POOLFREE,
+    VM_EXTERN_POOLUSAGE,
+    VM_NEXTERNS
+};
+
+extern const PROGMEM VmExtern vmExterns[];
+
+// What the firmware tells the host about an extern, and what names are looked up by
+typedef struct
+{
+    unsigned long hash; // hashName() of the name
+    unsigned int id;
+    const VmExtern* ext;
+} VmExternEntry;
+
+extern const PROGMEM VmExternEntry vmExternRegistry[VM_NEXTERNS];
+
+unsigned long hashName(const char* name);
+const VmExtern* findExternById(unsigned int id);
+
+typedef struct
+{
+    char* dst;
+    char* src;
+    unsigned int length;
+} VmMemcpyArgs;
+
+typedef struct
+{
+    char* dst;
+    char c;
+    unsigned int length;
+} VmMemsetArgs;
+
+typedef struct
+{
+    char* a;
+    char* b;
+    unsigned int length;
+} VmMemcmpArgs;
+
+typedef struct
+{
+    char* pos;
+    char c;
+    unsigned int length;
+} VmMemchrArgs;
+
+// Pool of fixed-size blocks in VM memory, carved from the end of memory by the poolCreate
+// extern. Free blocks are linked through their first word
+typedef struct VmPool
+{
+    struct VmPool* next; // Pool created before this one
+    char* free;
+    unsigned int blockSize;
+    unsigned int count;
+    unsigned int used;
+    unsigned int peak;   // Most blocks ever in use
+    char blocks[];
+} VmPool;
+
+typedef struct
+{
+    unsigned int blockSize;
+    unsigned int count;
+} VmPoolCreateArgs;
+
+typedef struct
+{
+    VmPool* pool;
+} VmPoolArgs;
+
+typedef struct
+{
+    VmPool* pool;
+    char* block;
+} VmPoolFreeArgs;
+
 void vmInit();
 char getChar(void* pos);
 int getInt(void* pos);
@@ -156,7 +229,35 @@ void pushLong(VmThread* t, long l);
 void pushPtr(VmThread* t, void* p);
 void pushArray(VmThread* t, const void* data, int size);
 void popArray(void* data, VmThread* t, int size);
-VmArgBin* popVmArgBin();
+VmArgBin* allocVmArgBin(unsigned char argSize);
+bool inVmMemory(const void* pos, unsigned int length);
+int instructionSize(void* pos);
+
+long vmMemcpy(Object* self, void* args);
+long vmMemset(Object* self, void* args);
+long vmMemcmp(Object* self, void* args);
+long vmMemchr(Object* self, void* args);
+long vmPoolCreate(Object* self, void* args);
+long vmPoolAlloc(Object* self, void* args);
+long vmPoolFree(Object* self, void* args);
+long vmPoolUsage(Object* self, void* args);
+
+extern char mem[VM_MEMORY_SIZE];
+extern void* programSection;
+extern void* externSection;
+extern void* freeSection; // Memory after the program, where thread stacks are allocated
+
+#ifdef VM_COUNT_INSTRUCTIONS
+extern volatile unsigned long vmInstructionCount;
+#endif
+#ifdef VM_COUNT_CYCLES
+extern unsigned long vmClassCycles[VM_NCLASSES];
+extern unsigned long vmClassCount[VM_NCLASSES];
+#endif
+
+// Why a received program doesn't run, reported to the host in a REJECT_HEADER frame
+#define VM_REJECT_VERIFY 1  // Malformed, or its code and the verifier's tables don't fit in memory
+#define VM_REJECT_MESSAGE 2 // No argument block for the message that starts it
 
 void loadProgramSegment(int totalLength, int seq, int segmentLength, void* buffer);
 void exec(Object* obj, int arg);
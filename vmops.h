@@ -0,0 +1,325 @@
+#ifndef VMOPS_H
+#define VMOPS_H
+
+// Opcodes of the VM, shared with the host tools in tools/
+
+#define OP_PUSHFP 0x01
+#define OP_PUSHIMM 0x02
+#define OP_PUSHADDR 0x03
+#define OP_PUSHBYTEFP 0x04
+#define OP_PUSHWORDFP 0x05
+#define OP_PUSHDWORDFP 0x06
+#define OP_PUSHBYTEADDR 0x07
+#define OP_PUSHWORDADDR 0x08
+#define OP_PUSHDWORDADDR 0x09
+#define OP_PUSHBYTEIMM 0x0A
+#define OP_PUSHWORDIMM 0x0B
+#define OP_PUSHDWORDIMM 0x0C
+#define OP_PUSHBYTE 0x0D
+#define OP_PUSHWORD 0x0E
+#define OP_PUSHDWORD 0x0F
+#define OP_POPIMM 0x10
+#define OP_POPBYTEFP 0x11
+#define OP_POPWORDFP 0x12
+#define OP_POPDWORDFP 0x13
+#define OP_POPBYTEADDR 0x14
+#define OP_POPWORDADDR 0x15
+#define OP_POPDWORDADDR 0x16
+#define OP_POPBYTE 0x17
+#define OP_POPWORD 0x18
+#define OP_POPDWORD 0x19
+#define OP_CALL 0x1A
+#define OP_RET 0x1B
+#define OP_SYNC 0x1C
+#define OP_ASYNC 0x1D
+#define OP_CALLE 0x1E
+#define OP_ADDBYTE 0x1F
+#define OP_ADDWORD 0x20
+#define OP_ADDDWORD 0x21
+#define OP_SUBBYTE 0x22
+#define OP_SUBWORD 0x23
+#define OP_SUBDWORD 0x24
+#define OP_MULBYTE 0x25
+#define OP_MULWORD 0x26
+#define OP_MULDWORD 0x27
+#define OP_DIVBYTE 0x28
+#define OP_DIVWORD 0x29
+#define OP_DIVDWORD 0x2A
+#define OP_MODBYTE 0x2B
+#define OP_MODWORD 0x2C
+#define OP_MODDWORD 0x2D
+    
+#define OP_ANDBYTE 0x2E
+#define OP_ANDWORD 0x2F
+#define OP_ANDDWORD 0x30
+    
+#define OP_ORBYTE 0x31
+#define OP_ORWORD 0x32
+#define OP_ORDWORD 0x33
+    
+#define OP_XORBYTE 0x34
+#define OP_XORWORD 0x35
+#define OP_XORDWORD 0x36
+    
+#define OP_SGZBYTE 0x37
+#define OP_SGZWORD 0x38
+#define OP_SGZDWORD 0x39
+
+#define OP_SGEZBYTE 0x3A
+#define OP_SGEZWORD 0x3B
+#define OP_SGEZDWORD 0x3C
+           
+#define OP_SEZBYTE 0x3D
+#define OP_SEZWORD 0x3E
+#define OP_SEZDWORD 0x3F
+           
+#define OP_SNEZBYTE 0x40
+#define OP_SNEZWORD 0x41
+#define OP_SNEZDWORD 0x42
+    
+#define OP_JMP 0x43
+
+#define OP_JEZ 0x44
+#define OP_JNEZ 0x45
+
+#define OP_SLLBYTE 0x46
+#define OP_SLLWORD 0x47
+#define OP_SLLDWORD 0x48
+
+#define OP_SLLVBYTE 0x49
+#define OP_SLLVWORD 0x4A
+#define OP_SLLVDWORD 0x4B
+
+#define OP_SRLBYTE 0x4C
+#define OP_SRLWORD 0x4D
+#define OP_SRLDWORD 0x4E
+
+#define OP_SRLVBYTE 0x4F
+#define OP_SRLVWORD 0x50
+#define OP_SRLVDWORD 0x51
+
+#define OP_SRABYTE 0x52
+#define OP_SRAWORD 0x53
+#define OP_SRADWORD 0x54
+
+#define OP_SRAVBYTE 0x55
+#define OP_SRAVWORD 0x56
+#define OP_SRAVDWORD 0x57
+
+// Superinstructions, only ever written by fuseInstructions() when linking. Each one stands
+// for the sequence in its comment and is encoded as exactly that sequence
+#define OP_ADDWORDFPFP 0x58   // PUSHWORDFP a, PUSHWORDFP b, ADDWORD, POPWORDFP c
+#define OP_SUBWORDFPFP 0x59   // PUSHWORDFP a, PUSHWORDFP b, SUBWORD, POPWORDFP c
+#define OP_ADDWORDFPIMM 0x5A  // PUSHWORDFP a, PUSHWORDIMM k, ADDWORD, POPWORDFP c
+#define OP_PUSH2WORDFP 0x5B   // PUSHWORDFP a, PUSHWORDFP b
+#define OP_MOVWORDFP 0x5C     // PUSHWORDFP a, POPWORDFP c
+#define OP_MOVWORDIMMFP 0x5D  // PUSHWORDIMM k, POPWORDFP c
+
+// Two-operand compares, [$sp] is the left hand side just like for SUB. Set ops push a byte,
+// the jumps pop both operands and branch. Greater-than forms are had by swapping operands
+#define OP_SLTBYTE 0x5E
+#define OP_SLTWORD 0x5F
+#define OP_SLTDWORD 0x60
+
+#define OP_SLEBYTE 0x61
+#define OP_SLEWORD 0x62
+#define OP_SLEDWORD 0x63
+
+#define OP_SEQBYTE 0x64
+#define OP_SEQWORD 0x65
+#define OP_SEQDWORD 0x66
+
+#define OP_SNEBYTE 0x67
+#define OP_SNEWORD 0x68
+#define OP_SNEDWORD 0x69
+
+#define OP_SLTUBYTE 0x6A
+#define OP_SLTUWORD 0x6B
+#define OP_SLTUDWORD 0x6C
+
+#define OP_SLEUBYTE 0x6D
+#define OP_SLEUWORD 0x6E
+#define OP_SLEUDWORD 0x6F
+
+#define OP_JLTBYTE 0x70
+#define OP_JLTWORD 0x71
+#define OP_JLTDWORD 0x72
+
+#define OP_JGEBYTE 0x73
+#define OP_JGEWORD 0x74
+#define OP_JGEDWORD 0x75
+
+#define OP_JEQBYTE 0x76
+#define OP_JEQWORD 0x77
+#define OP_JEQDWORD 0x78
+
+#define OP_JNEBYTE 0x79
+#define OP_JNEWORD 0x7A
+#define OP_JNEDWORD 0x7B
+
+#define OP_JLTUBYTE 0x7C
+#define OP_JLTUWORD 0x7D
+#define OP_JLTUDWORD 0x7E
+
+#define OP_JGEUBYTE 0x7F
+#define OP_JGEUWORD 0x80
+#define OP_JGEUDWORD 0x81
+
+// Arithmetic and logic with an immediate of the operand width as right hand side,
+// [$sp] is replaced with the result
+#define OP_ADDBYTEIMM 0x82
+#define OP_ADDWORDIMM 0x83
+#define OP_ADDDWORDIMM 0x84
+
+#define OP_SUBBYTEIMM 0x85
+#define OP_SUBWORDIMM 0x86
+#define OP_SUBDWORDIMM 0x87
+
+#define OP_ANDBYTEIMM 0x88
+#define OP_ANDWORDIMM 0x89
+#define OP_ANDDWORDIMM 0x8A
+
+#define OP_ORBYTEIMM 0x8B
+#define OP_ORWORDIMM 0x8C
+#define OP_ORDWORDIMM 0x8D
+
+#define OP_XORBYTEIMM 0x8E
+#define OP_XORWORDIMM 0x8F
+#define OP_XORDWORDIMM 0x90
+
+#define OP_MULBYTEIMM 0x91
+#define OP_MULWORDIMM 0x92
+#define OP_MULDWORDIMM 0x93
+
+// [$fp+c] += imm, the immediate has the width of the local and follows c
+#define OP_INCBYTEFP 0x94
+#define OP_INCWORDFP 0x95
+#define OP_INCDWORDFP 0x96
+
+// Indexed and displaced loads and stores. The IDX forms pop a word index (stores then pop
+// the value below it) and access base + index*scale, where base is a label or $fp+c and
+// the unsigned scale byte follows the base operand. The DISP forms pop a pointer instead
+// and access pointer + d
+#define OP_PUSHBYTEADDRIDX 0x97
+#define OP_PUSHWORDADDRIDX 0x98
+#define OP_PUSHDWORDADDRIDX 0x99
+
+#define OP_PUSHBYTEFPIDX 0x9A
+#define OP_PUSHWORDFPIDX 0x9B
+#define OP_PUSHDWORDFPIDX 0x9C
+
+#define OP_PUSHBYTEDISP 0x9D
+#define OP_PUSHWORDDISP 0x9E
+#define OP_PUSHDWORDDISP 0x9F
+
+#define OP_POPBYTEADDRIDX 0xA0
+#define OP_POPWORDADDRIDX 0xA1
+#define OP_POPDWORDADDRIDX 0xA2
+
+#define OP_POPBYTEFPIDX 0xA3
+#define OP_POPWORDFPIDX 0xA4
+#define OP_POPDWORDFPIDX 0xA5
+
+#define OP_POPBYTEDISP 0xA6
+#define OP_POPWORDDISP 0xA7
+#define OP_POPDWORDDISP 0xA8
+
+// Short forms. The FPS forms take a signed byte frame offset, the IMMS forms a byte that
+// is sign extended to the pushed width (PUSHIMMS and POPIMMS an unsigned byte $sp offset)
+#define OP_PUSHFPS 0xA9
+#define OP_PUSHBYTEFPS 0xAA
+#define OP_PUSHWORDFPS 0xAB
+#define OP_PUSHDWORDFPS 0xAC
+#define OP_POPBYTEFPS 0xAD
+#define OP_POPWORDFPS 0xAE
+#define OP_POPDWORDFPS 0xAF
+#define OP_PUSHWORDIMMS 0xB0
+#define OP_PUSHDWORDIMMS 0xB1
+#define OP_PUSHIMMS 0xB2
+#define OP_POPIMMS 0xB3
+
+// Operand-less forms for the first four word locals, [$fp-2] to [$fp-8], and the first two
+// word arguments, [$fp+4] and [$fp+6]
+#define OP_PUSHWORDLOC0 0xB4
+#define OP_PUSHWORDLOC1 0xB5
+#define OP_PUSHWORDLOC2 0xB6
+#define OP_PUSHWORDLOC3 0xB7
+#define OP_POPWORDLOC0 0xB8
+#define OP_POPWORDLOC1 0xB9
+#define OP_POPWORDLOC2 0xBA
+#define OP_POPWORDLOC3 0xBB
+#define OP_PUSHWORDARG0 0xBC
+#define OP_PUSHWORDARG1 0xBD
+
+// Jumps with a signed byte displacement relative to the next instruction, position
+// independent so linkProgram has nothing to relocate
+#define OP_JMPS 0xBE
+#define OP_JEZS 0xBF
+#define OP_JNEZS 0xC0
+
+// Jump through an inline table: count (unsigned byte), default target, then count targets.
+// Pops a word index and jumps to the default target if it is out of range. The length
+// depends on count, so instructionLength holds 0 for it, see instructionSize()
+#define OP_TABLESWITCH 0xC1
+
+// Direct access to I/O registers: data space address (2 bytes) and bit mask (1 byte).
+// IN pushes the masked register as a byte, OUT pops a byte and writes the masked bits,
+// SBI and CBI set and clear the masked bits. linkProgram checks every access against
+// ioWhitelist and narrows the mask to the permitted bits
+#define OP_IN 0xC2
+#define OP_OUT 0xC3
+#define OP_SBI 0xC4
+#define OP_CBI 0xC5
+
+// Decrement word [$fp+c] (2 bytes) and jump to the target (2 bytes) unless it became zero
+#define OP_DJNZWORDFP 0xC6
+
+// Call the target (2 bytes) in place of the current method: the new arguments on top of
+// the stack (size in the next byte) replace the arguments of the current frame (size in
+// the byte after that), and the callee returns straight to our caller
+#define OP_TAILCALL 0xC7
+
+// Suspension. SLEEP pops a word of milliseconds and continues after that offset from the
+// current baseline. AWAIT pops the address of a semaphore (count word, then the first
+// waiter, both zeroed by the program) and takes one from the count or waits for a NOTIFY,
+// pushing a byte 1. NOTIFY pops a semaphore address and wakes the first waiter or adds to
+// the count. A waiting thread gives up its kernel thread and keeps only its VmThread.
+// Threads that can't be parked can't do that: SLEEP does nothing there, and AWAIT pushes
+// 0 instead of waiting. A waiting thread still holds its VmThread, its stack and the
+// VmArgBin of its message, so running and waiting activities together are limited to
+// VM_NTHREADS and to the stacks that fit in memory. Messages that find neither start once
+// a thread returns, and they and all pending messages share the VM_ARGARENA_SIZE arena
+#define OP_SLEEP 0xC8
+#define OP_AWAIT 0xC9
+#define OP_NOTIFY 0xCA
+
+// OP_HOT (operand byte ignored) marks the start of a run of instructions worth translating
+// into native code. Nothing translates them yet, so it is a no-op. OP_NATIVE is reserved
+// for calling such a translation and is rejected in programs
+#define OP_HOT 0xCB
+#define OP_NATIVE 0xCC
+
+// Single producer, single consumer channels in VM memory: the consumer waiting for an item
+// (word), the index of the next item to receive and of the next free slot (bytes), all
+// zeroed by the program, then the number of slots (byte) and the slots, of which one always
+// stays empty. The operand byte is the size of an item. CHSEND pops the channel address
+// and an item, stores the item and pushes a byte 1 if there's room, or just pushes 0.
+// CHRECV pops the channel address and pushes the oldest item and a byte 1, or waits for
+// an item if there is none. Only a waiting consumer is woken, so a consumer that drains
+// the channel gets one message however many items are sent meanwhile. Threads that can't
+// be parked get a zeroed item and 0 instead of waiting
+#define OP_CHSEND 0xCD
+#define OP_CHRECV 0xCE
+
+// Futures for the results of asynchronous calls, 8 bytes of VM memory: state (word), first
+// waiter (word) and value (dword). ASYNCF is ASYNC with the address of a future popped
+// after the method. It sets the state to 0, and the final RET of the call stores the dword
+// on top of the callee's stack as the value (so a word left there ends up in its low
+// word) and sets the state to 1. The state is 2 if the message couldn't be sent. FPOLL
+// pops a future address and pushes its state as a byte. FAWAIT does the same, but first
+// waits for the call to return, if the thread can be parked (pushing 0 if not)
+#define OP_ASYNCF 0xCF
+#define OP_FPOLL 0xD0
+#define OP_FAWAIT 0xD1
+
+#endif